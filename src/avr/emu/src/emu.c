@@ -26,8 +26,11 @@
 \******************************************************************************/
 
 #include <config.h>
+#include <vfd_spindle.h>
+#include <rtc.h>
 
 #include <avr/io.h>
+#include <util/crc16.h>
 
 #include <stdio.h>
 #include <string.h>
@@ -45,6 +48,7 @@ void __ADCA_CH1_vect();      // Analog input
 void __RS485_DRE_vect();     // RS848
 void __RS485_TXC_vect();     // RS848
 void __RS485_RXC_vect();     // RS848
+void __RS485_SILENCE_vect(); // RS848 inter-character timeout
 void __SERIAL_DRE_vect();    // Serial to RPi
 void __SERIAL_RXC_vect();    // Serial from RPi
 void __STEP_LOW_LEVEL_ISR(); // Stepper lo interrupt
@@ -52,6 +56,9 @@ void __STEP_TIMER_ISR();     // Stepper hi interrupt
 void __RTC_OVF_vect();       // RTC tick
 
 void motor_emulate_steps(int motor);
+uint8_t get_vfd_reg_type(int reg);
+uint16_t get_vfd_reg_addr(int reg);
+uint16_t get_vfd_reg_val(int reg);
 
 extern int __argc;
 extern char **__argv;
@@ -61,6 +68,8 @@ volatile uint8_t io_mem[4096] = {0};
 
 
 bool fast = false;
+bool vfdSim = false;
+bool vfdNoMulti = false;
 int serialByte = -1;
 uint8_t i2cData[I2C_MAX_DATA];
 int i2cIndex = 0;
@@ -72,10 +81,155 @@ void cli() {}
 void sei() {}
 
 
+// Simulated Modbus VFD, a bank of holding registers on the RS485 port.  The
+// output frequency ramps toward the commanded frequency using the registers
+// of the loaded VFD profile.
+uint16_t vfdRegs[65536];
+uint8_t vfdRequest[64];
+uint8_t vfdResponse[64];
+int vfdRequestLen = 0;
+int vfdResponseLen = 0;
+int vfdResponseIndex = 0;
+
+
+static uint16_t vfd_crc(const uint8_t *data, int length) {
+  uint16_t crc = 0xffff;
+  for (int i = 0; i < length; i++) crc = _crc16_update(crc, data[i]);
+  return crc;
+}
+
+
+static uint16_t vfd_word(const uint8_t *data) {return data[0] << 8 | data[1];}
+
+
+static void vfd_put_word(uint8_t *data, uint16_t value) {
+  data[0] = value >> 8;
+  data[1] = value;
+}
+
+
+static void vfd_log(const char *name, const uint8_t *data, int length) {
+  fprintf(stderr, "vfd: %u %s=0x", (unsigned)rtc_get_time(), name);
+  for (int i = 0; i < length; i++) fprintf(stderr, "%02x", data[i]);
+  fprintf(stderr, "\n");
+}
+
+
+static void vfd_respond() {
+  const uint8_t *req = vfdRequest;
+  int len = vfdRequestLen;
+  uint8_t *resp = vfdResponse;
+
+  vfdRequestLen = vfdResponseLen = vfdResponseIndex = 0;
+  vfd_log("req", req, len);
+
+  if (len < 8 || vfd_crc(req, len - 2) != (req[len - 1] << 8 | req[len - 2]))
+    return; // Bad frame, let the master time out
+
+  uint16_t addr = vfd_word(req + 2);
+  uint16_t count = vfd_word(req + 4);
+  uint8_t exception = 0;
+  memcpy(resp, req, 2);
+
+  switch (req[1]) {
+  case 3:
+    if (count < 1 || 29 < count) {exception = 3; break;} // Illegal value
+    resp[2] = 2 * count;
+    for (int i = 0; i < count; i++)
+      vfd_put_word(resp + 3 + 2 * i, vfdRegs[(uint16_t)(addr + i)]);
+    vfdResponseLen = 3 + 2 * count;
+    break;
+
+  case 6:
+    vfdRegs[addr] = count;
+    memcpy(resp, req, 6);
+    vfdResponseLen = 6;
+    break;
+
+  case 16:
+    if (vfdNoMulti) {exception = 1; break;} // Illegal function
+    if (len != 9 + req[6] || req[6] != 2 * count) {exception = 3; break;}
+    for (int i = 0; i < count; i++)
+      vfdRegs[(uint16_t)(addr + i)] = vfd_word(req + 7 + 2 * i);
+    memcpy(resp, req, 6);
+    vfdResponseLen = 6;
+    break;
+
+  default: exception = 1; break;
+  }
+
+  if (exception) {
+    resp[1] |= 0x80;
+    resp[2] = exception;
+    vfdResponseLen = 3;
+  }
+
+  uint16_t crc = vfd_crc(resp, vfdResponseLen);
+  resp[vfdResponseLen++] = crc;
+  resp[vfdResponseLen++] = crc >> 8;
+  vfd_log("resp", resp, vfdResponseLen);
+}
+
+
+static int vfd_find_reg(vfd_reg_type_t type) {
+  for (int i = 0; i < VFDREG; i++)
+    if (get_vfd_reg_type(i) == type) return i;
+  return -1;
+}
+
+
+static void vfd_ramp() {
+  const uint16_t maxFreq = 40000;
+  int maxReg = vfd_find_reg(REG_MAX_FREQ_READ);
+  int setReg = vfd_find_reg(REG_FREQ_SET);
+  int stopReg = vfd_find_reg(REG_STOP_WRITE);
+  int readReg = vfd_find_reg(REG_FREQ_READ);
+
+  if (maxReg != -1) vfdRegs[get_vfd_reg_addr(maxReg)] = maxFreq;
+  if (setReg == -1 || readReg == -1) return;
+
+  uint16_t target = vfdRegs[get_vfd_reg_addr(setReg)];
+  if (stopReg != -1 && get_vfd_reg_addr(stopReg) != get_vfd_reg_addr(setReg) &&
+      vfdRegs[get_vfd_reg_addr(stopReg)] == get_vfd_reg_val(stopReg))
+    target = 0;
+
+  // Full speed in one second
+  uint16_t &freq = vfdRegs[get_vfd_reg_addr(readReg)];
+  const uint16_t step = maxFreq / 1000;
+  if (freq + step < target) freq += step;
+  else if (target + step < freq) freq -= step;
+  else freq = target;
+}
+
+
+// Moves one byte per call, close to the character time at 9600 baud
+static void vfd_callback() {
+  vfd_ramp();
+
+  if (RS485_PORT.CTRLA & USART_DREINTLVL_gm) {
+    __RS485_DRE_vect();
+    if (vfdRequestLen < (int)sizeof(vfdRequest))
+      vfdRequest[vfdRequestLen++] = RS485_PORT.DATA;
+
+  } else if (RS485_PORT.CTRLA & USART_TXCINTLVL_gm) {
+    __RS485_TXC_vect();
+    vfd_respond();
+
+  } else if (RS485_PORT.CTRLA & USART_RXCINTLVL_gm &&
+             vfdResponseIndex < vfdResponseLen) {
+    RS485_PORT.DATA = vfdResponse[vfdResponseIndex++];
+    __RS485_RXC_vect();
+  }
+}
+
+
 void emu_init() {
   // Parse command line args
   for (int i = 0; i < __argc; i++)
     if (strcmp(__argv[i], "--fast") == 0) fast = true;
+    else if (strcmp(__argv[i], "--vfd") == 0) vfdSim = true;
+    else if (strcmp(__argv[i], "--vfd-no-multi") == 0)
+      vfdSim = vfdNoMulti = true;
 
   // Mark clocks ready
   OSC.STATUS = OSC_XOSCRDY_bm | OSC_PLLRDY_bm | OSC_RC32KRDY_bm;
@@ -150,11 +304,17 @@ void emu_callback() {
     }
   }
 
+  // The step timer compare matches once per period
+  if (TIMER_STEP.INTCTRLB & TC0_CCBINTLVL_gm) __RS485_SILENCE_vect();
+
   // Call stepper ISRs
   if (ADCB_CH0_INTCTRL == ADC_CH_INTLVL_LO_gc) __STEP_LOW_LEVEL_ISR();
-  for (int motor = 0; motor < 4; motor++) motor_emulate_steps(motor);
+  for (int motor = 0; motor < MOTORS; motor++) motor_emulate_steps(motor);
   __STEP_TIMER_ISR();
 
+  // Simulated VFD
+  if (vfdSim) vfd_callback();
+
   // Call RTC
   __RTC_OVF_vect();
 
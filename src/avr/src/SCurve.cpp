@@ -104,9 +104,10 @@ float SCurve::stoppingDist(float v, float a, float maxA, float maxJ) {
     a = 0;
   }
 
-  // Compute max deccel
-  float maxDeccel = -sqrt(v * maxJ + 0.5 * a * a);
-  if (maxDeccel < -maxA) maxDeccel = -maxA;
+  // Compute max deccel, avoiding the square root when limited by maxA
+  float maxDeccel2 = v * maxJ + 0.5 * a * a;
+  float maxDeccel =
+    maxA * maxA < maxDeccel2 ? -maxA : -sqrt(maxDeccel2);
 
   // Compute distance and velocity change to max deccel
   if (maxDeccel < a) {
@@ -144,9 +145,10 @@ float SCurve::nextAccel(float t, float targetV, float v, float a, float maxA,
   if (!increasing && deltaA < a)
     return a - deltaA; // positive accel, decreasing speed
 
+  // Avoid the square root when limited by maxA
   float deltaV = fabs(targetV - v);
-  float targetA = sqrt(2 * deltaV * maxJ);
-  if (maxA < targetA) targetA = maxA;
+  float targetA2 = 2 * deltaV * maxJ;
+  float targetA = maxA * maxA < targetA2 ? maxA : sqrt(targetA2);
 
   if (increasing) {
     if (targetA < a + deltaA) return targetA;
@@ -172,3 +174,12 @@ float SCurve::velocity(float t, float a, float j) {
 
 
 float SCurve::acceleration(float t, float j) {return j * t;}
+
+
+// Computes distance, velocity and acceleration change together, sharing terms
+void SCurve::evaluate(float t, float v, float a, float j, float &d, float &dv,
+                      float &da) {
+  da = j * t;
+  dv = t * (a + 0.5 * da);
+  d = t * (v + t * (0.5 * a + 1.0 / 6.0 * da));
+}
@@ -63,4 +63,6 @@ public:
   static float distance(float t, float v, float a, float j);
   static float velocity(float t, float a, float j);
   static float acceleration(float t, float j);
+  static void evaluate(float t, float v, float a, float j, float &d,
+                       float &dv, float &da);
 };
@@ -39,6 +39,8 @@
 #include "base64.h"
 #include "rtc.h"
 #include "stepper.h"
+#include "line.h"
+#include "util.h"
 #include "cpp_magic.h"
 
 #include <util/atomic.h>
@@ -54,6 +56,7 @@
 #define RING_BUF_INDEX_TYPE volatile uint16_t
 #define RING_BUF_SIZE SYNC_QUEUE_SIZE
 #define RING_BUF_ATOMIC_COPY 1
+#define RING_BUF_CONTIGUOUS INPUT_BUFFER_LEN
 #include "ringbuf.def"
 
 
@@ -62,7 +65,16 @@ static struct {
   uint16_t id;
   uint32_t last_empty;
   volatile uint16_t count;
+  uint8_t frame; // Payload length of the current binary frame
+  uint8_t seq;   // Sequence number of the last consumed frame
+  uint8_t line_size; // Queue space used by the last line
+  bool batch;        // Holding committed commands back from exec
+  uint8_t batch_count;
+  uint16_t batch_space;
+  uint8_t batch_line_size;
   float position[AXES];
+  int32_t fixed[AXES]; // Position in FIXED_POSITION_UNIT
+  uint8_t fixed_valid; // Axes with a valid fixed position
 } cmd = {0,};
 
 
@@ -116,6 +128,11 @@ static unsigned _size(char code) {
 }
 
 
+// Queued commands are [size][code][data], where size is the length of data.
+// Data may be shorter than the command's maximum size.
+static unsigned _record_size(char code) {return _size(code) + 2;}
+
+
 static void _exec_cb(char code, uint8_t *data) {
   switch (code) {
 #define CMD(CODE, NAME, SYNC, ...)                                      \
@@ -132,9 +149,29 @@ static void _i2c_cb(uint8_t *data, uint8_t length) {
 }
 
 
+// Binary frames are [STX][length][seq][payload][CRC-8], the length counts the
+// sequence number and payload and the CRC covers everything but the STX
+static stat_t _frame_check(const uint8_t *frame) {
+  uint8_t length = frame[1];
+
+  if (length < 2 || INPUT_BUFFER_LEN - 4 < length) return STAT_BAD_FRAME;
+  if (crc8(frame + 1, length + 1) != frame[length + 2]) return STAT_BAD_FRAME;
+
+  return STAT_OK;
+}
+
+
 void command_init() {i2c_set_read_callback(_i2c_cb);}
 bool command_is_active() {return cmd.active;}
 unsigned command_get_count() {return cmd.count;}
+unsigned command_frame_length() {return cmd.frame;}
+uint8_t command_get_seq() {return cmd.seq;}
+unsigned command_get_space() {return sync_q_space();}
+
+
+unsigned command_get_line_space() {
+  return cmd.line_size ? cmd.line_size : _record_size(COMMAND_binary_line);
+}
 
 
 void command_print_json() {
@@ -154,28 +191,112 @@ void command_flush_queue() {
   sync_q_init();
   cmd.count = 0;
   command_reset_position();
+  line_flush();
 }
 
 
-void command_push(char code, void *_data) {
-  uint8_t *data = (uint8_t *)_data;
-  unsigned size = _size(code);
+// Returns true if count commands of the given type fit in the queue
+bool command_has_space(char code, unsigned count) {
+  return count * _record_size(code) <= sync_q_space();
+}
+
 
+static uint8_t *_reserve(char code) {
   ESTOP_ASSERT(_is_synchronous(code), STAT_Q_INVALID_PUSH);
-  ESTOP_ASSERT(size < sync_q_space(), STAT_Q_OVERRUN);
+  ESTOP_ASSERT(_record_size(code) <= sync_q_space(), STAT_Q_OVERRUN);
 
-  sync_q_push(code);
-  for (unsigned i = 0; i < size; i++) sync_q_push(*data++);
+  uint8_t *record = sync_q_reserve();
+  record[1] = code;
 
-  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) cmd.count++;
+  return record + 2;
+}
+
+
+// Returns zeroed queue storage for the command's data.  It is only queued by
+// command_commit() so a command may be abandoned by not committing it.
+// Variable length commands may commit less than their maximum size.
+void *command_reserve(char code) {
+  uint8_t *data = _reserve(code);
+  memset(data, 0, _size(code));
+  return data;
+}
+
+
+void command_commit(unsigned size) {
+  uint8_t *record = sync_q_reserve();
+  char code = (char)record[1];
+
+  ESTOP_ASSERT(size <= _size(code), STAT_Q_OVERRUN);
+
+  record[0] = size;
+  sync_q_commit(size + 2);
+
+  switch (code) {
+  case COMMAND_line: case COMMAND_binary_line: case COMMAND_line_batch:
+    cmd.line_size = size + 2;
+    break;
+  }
+
+  if (cmd.batch) {
+    cmd.batch_count++;
+    cmd.batch_space += size + 2;
+
+  } else ATOMIC_BLOCK(ATOMIC_RESTORESTATE) cmd.count++;
+}
+
+
+// Commands committed until command_end_batch() are not executed, so a batch
+// can be decoded straight into the queue and dropped if any of it is bad.
+void command_begin_batch() {
+  cmd.batch = true;
+  cmd.batch_count = 0;
+  cmd.batch_space = 0;
+  cmd.batch_line_size = cmd.line_size;
+}
+
+
+void command_end_batch(bool keep) {
+  cmd.batch = false;
+
+  if (keep) ATOMIC_BLOCK(ATOMIC_RESTORESTATE) cmd.count += cmd.batch_count;
+  else {
+    sync_q_uncommit(cmd.batch_space);
+    cmd.line_size = cmd.batch_line_size;
+  }
+}
+
+
+void command_push(char code, void *data) {
+  memcpy(_reserve(code), data, _size(code));
+  command_commit(_size(code));
 }
 
 
 bool command_callback() {
   static char *block = 0;
-
-  if (!block) block = usart_readline();
-  if (!block) return false; // No command
+  static uint8_t seq;
+
+  if (!block) {
+    block = usart_readline();
+    if (!block) return false; // No command
+
+    // Unwrap binary frames
+    cmd.frame = 0;
+    if (*block == USART_FRAME_START) {
+      stat_t status = _frame_check((uint8_t *)block);
+
+      if (status) {
+        STATUS_ERROR(status, "");
+        usart_rx_resync();
+        block = 0;
+        return true;
+      }
+
+      cmd.frame = block[1] - 1;
+      seq = block[2];
+      block += 3;
+    }
+  }
 
   stat_t status = STAT_OK;
 
@@ -183,13 +304,14 @@ bool command_callback() {
   if (_is_synchronous(*block)) {
     if (estop_triggered()) status = STAT_MACHINE_ALARMED;
     else if (state_is_flushing()) status = STAT_NOP; // Flush command
-    else if (state_is_resuming() || sync_q_space() <= _size(*block))
+    else if (state_is_resuming() || sync_q_space() < _record_size(*block))
       return false; // Wait
   }
 
   // Dispatch non-empty commands
   if (*block && status == STAT_OK) {
     status = _dispatch(block);
+    if (status == STAT_AGAIN) return false; // Wait
     if (status == STAT_OK) cmd.active = true; // Disables LCD booting message
   }
 
@@ -197,22 +319,44 @@ bool command_callback() {
   case STAT_OK: break;
   case STAT_NOP: break;
   case STAT_MACHINE_ALARMED: STATUS_WARNING(status, ""); break;
-  default: STATUS_ERROR(status, "%s", block); break;
+  default:
+    if (cmd.frame) STATUS_ERROR(status, "frame %c", *block);
+    else STATUS_ERROR(status, "%s", block);
+    break;
   }
 
+  if (cmd.frame) cmd.seq = seq; // Acknowledged in credit reports
   block = 0; // Command consumed
 
   return true;
 }
 
 
+void command_set_id(uint16_t id) {cmd.id = id;}
+
+
 void command_set_axis_position(int axis, const float p) {
   cmd.position[axis] = p;
+  cmd.fixed_valid &= ~(1 << axis);
 }
 
 
 void command_set_position(const float position[AXES]) {
   memcpy(cmd.position, position, sizeof(cmd.position));
+  cmd.fixed_valid = 0;
+}
+
+
+void command_set_fixed_position(int axis, int32_t p) {
+  cmd.fixed[axis] = p;
+  cmd.fixed_valid |= 1 << axis;
+  cmd.position[axis] = p * FIXED_POSITION_UNIT;
+}
+
+
+bool command_get_fixed_position(int axis, int32_t *p) {
+  *p = cmd.fixed[axis];
+  return cmd.fixed_valid & (1 << axis);
 }
 
 
@@ -228,26 +372,24 @@ void command_reset_position() {
 }
 
 
-char command_peek() {return (char)(cmd.count ? sync_q_peek() : 0);}
+char command_peek() {return (char)(cmd.count ? sync_q_get(1) : 0);}
 
 
+// The command is read in place.  It is released from the queue immediately
+// but is not overwritten until the main loop next queues a command.
 uint8_t *command_next() {
   if (!cmd.count) return 0;
   cmd.count--;
 
   ESTOP_ASSERT(!sync_q_empty(), STAT_Q_UNDERRUN);
 
-  static uint8_t data[INPUT_BUFFER_LEN];
-
-  data[0] = sync_q_next();
+  uint8_t *record = sync_q_front();
 
-  ESTOP_ASSERT(_is_synchronous((char)data[0]), STAT_INVALID_QCMD);
+  ESTOP_ASSERT(_is_synchronous((char)record[1]), STAT_INVALID_QCMD);
 
-  unsigned size = _size((char)data[0]);
-  for (unsigned i = 0; i < size; i++)
-    data[i + 1] = sync_q_next();
+  sync_q_release(record[0] + 2);
 
-  return data;
+  return record + 1;
 }
 
 
@@ -275,4 +417,4 @@ bool command_exec() {
 
 // Var callbacks
 uint16_t get_id() {return cmd.id;}
-void set_id(uint16_t id) {cmd.id = id;}
+void set_id(uint16_t id) {command_set_id(id);}
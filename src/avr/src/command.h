@@ -45,12 +45,24 @@ typedef enum {
 void command_init();
 bool command_is_active();
 unsigned command_get_count();
+unsigned command_frame_length();
+uint8_t command_get_seq();
+unsigned command_get_space();
+unsigned command_get_line_space();
 void command_print_json();
 void command_flush_queue();
+bool command_has_space(char code, unsigned count);
+void *command_reserve(char code);
+void command_commit(unsigned size);
+void command_begin_batch();
+void command_end_batch(bool keep);
 void command_push(char code, void *data);
 bool command_callback();
+void command_set_id(uint16_t id);
 void command_set_axis_position(int axis, const float p);
 void command_set_position(const float position[AXES]);
+void command_set_fixed_position(int axis, int32_t p);
+bool command_get_fixed_position(int axis, int32_t *p);
 void command_get_position(float position[AXES]);
 void command_reset_position();
 char command_peek();
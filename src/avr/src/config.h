@@ -93,13 +93,24 @@ enum {
 
 
 #define AXES                     6 // number of axes
-#define MOTORS                   4 // number of motors on the board
+#define MOTORS                   5 // number of motors on the board
+#define DRIVERS                  4 // number of on board motor drivers
+#define ENCODERS                 4 // number of quadrature encoder inputs
+#define PITCH_POINTS            40 // pitch error table entries for all motors
+#define MOTOR_PITCH_POINTS       (PITCH_POINTS / MOTORS)
 #define INS                      6 // number of supported pin outputs
 #define OUTS                    10 // number of supported pin outputs
 #define ANALOGS                  2 // number of supported analog inputs
 #define DIGITALS                 4 // number of supported digital inputs
 #define VFDREG                  32 // number of supported VFD modbus registers
 #define IO_PINS                 17 // number of supported i/o pins
+#define TIMED_ISRS               5 // number of ISRs with timing statistics
+
+// ISR time and step slack statistics, see timing.c.  Off by default because
+// they add work to every step, RX, RTC and I2C interrupt.
+#ifndef ISR_TIMING
+#define ISR_TIMING               0
+#endif
 
 // Input settings.  See io.c
 #define INPUT_DEBOUNCE          5 // ms, default value
@@ -110,13 +121,24 @@ enum {
 
 // Motor ISRs
 #define STALL_ISR_vect           PORTA_INT1_vect
-#define FAULT_ISR_vect           PORTF_INT1_vect
+
+// Quadrature encoder ISRs, one per port with input pins
+#define ENCODER_B_ISR_vect       PORTB_INT1_vect
+#define ENCODER_F_ISR_vect       PORTF_INT1_vect
+
+// Seek switch position latch ISRs, one per port with input pins
+#define SEEK_A_ISR_vect          PORTA_INT0_vect
+#define SEEK_B_ISR_vect          PORTB_INT0_vect
+#define SEEK_F_ISR_vect          PORTF_INT0_vect
 
 
 /* Interrupt usage:
  *
  *    HI    Step timers                          stepper.c
+ *    HI    Software step pulses                 motor.c
  *    HI    Serial RX                            usart.c
+ *    HI    Seek switch position latch           seek.c
+ *    HI    Quadrature encoder inputs            encoder.c
  *   MED    Serial TX                            usart.c (* see note)
  *   MED    Modbus serial interrupts             modbus.c
  *    LO    Segment execution SW interrupt       stepper.c
@@ -131,8 +153,8 @@ enum {
  */
 
 // Timer assignments
-// NOTE, TCC1 is unused
 #define TIMER_STEP               TCC0 // Step timer (see stepper.h)
+#define TIMER_SOFT_STEP          TCC1 // Software step motor (see motor.c)
 #define TIMER_PWM                TCD1 // PWM timer  (see pwm.c)
 
 
@@ -142,9 +164,21 @@ enum {
 #define STEP_TIMER_POLL          ((uint16_t)(STEP_TIMER_FREQ * 0.001)) // 1ms
 #define STEP_TIMER_ISR           TCC0_OVF_vect
 #define STEP_LOW_LEVEL_ISR       ADCB_CH0_vect
+#define STEP_RASTER_ISR          TCC0_CCA_vect
 #define STEP_PULSE_WIDTH         (F_CPU * 0.000002) // 2uS w/ clk/1
-#define SEGMENT_MS               4
+#define SOFT_STEP_ISR            TCC1_OVF_vect
+#define SOFT_STEP_PULSE_ISR      TCC1_CCA_vect
+#define SOFT_STEP_MAX_RATE       10000 // Hz, each step takes two interrupts
+#define SOFT_STEP_MIN_PERIOD     (F_CPU / SOFT_STEP_MAX_RATE) // w/ clk/1
+#define SEGMENT_MS               4 // Nominal segment time
+#define SEGMENT_MIN_MS           2 // Accel segment time default
+#define SEGMENT_MAX_MS           8 // Cruise segment time default and limit
+#define STEP_QUEUE_SIZE          4 // Move ring, the running move + 2 prepped
 #define SEGMENT_TIME             (SEGMENT_MS / 60000.0) // mins
+#define FEED_OVERRIDE_MIN        0.1
+#define FEED_OVERRIDE_MAX        1.2 // Also limited by axis limits
+#define FEED_OVERRIDE_ACCEL      240   // per min, max rate of change
+#define FEED_OVERRIDE_JERK       57600 // per min^2
 
 
 // DRV8711 settings
@@ -174,13 +208,19 @@ enum {
 #define RS485_DRE_vect           USARTD1_DRE_vect
 #define RS485_TXC_vect           USARTD1_TXC_vect
 #define RS485_RXC_vect           USARTD1_RXC_vect
+#define RS485_SILENCE_vect       TCC0_CCB_vect // Shares the step timer
 
 
 // Modbus settings
 #define MODBUS_TIMEOUT           100 // ms. response timeout
 #define MODBUS_RETRIES           4   // Number of retries before failure
-#define MODBUS_BUF_SIZE          18  // Max bytes in rx/tx buffers
-#define VFD_QUERY_DELAY          100 // ms
+#define MODBUS_MAX_REGS          8   // Max registers per transaction
+#define MODBUS_BUF_SIZE          (9 + 2 * MODBUS_MAX_REGS) // rx/tx buffers
+// Poll delays are added to the Modbus round trip, about 15-20ms at 9600 baud.
+// Speed feedback therefore updates about every 25-30ms while ramping.
+#define VFD_QUERY_FAST           10  // ms, poll delay while ramping or synced
+#define VFD_QUERY_SLOW           250 // ms, poll delay once at speed
+#define VFD_AT_SPEED             0.02 // Fraction of max freq deemed at speed
 
 
 // Serial settings
@@ -189,17 +229,29 @@ enum {
 #define SERIAL_DRE_vect          USARTC0_DRE_vect
 #define SERIAL_RXC_vect          USARTC0_RXC_vect
 #define SERIAL_CTS_THRESH        4
+#define SERIAL_FRAME_TIMEOUT     50 // ms, max gap between binary frame bytes
 
 
 // PWM settings
-#define POWER_MAX_UPDATES        SEGMENT_MS
+#define POWER_MAX_UPDATES        SEGMENT_MAX_MS
+#define RASTER_SUBSTEPS          4   // Raster power updates per ms
+#define RASTER_MAX_PIXELS        128 // Raster powers per command
+
+// Spindle synchronized feed
+#define SPINDLE_SYNC_WINDOW      16  // ms, encoder speed measurement period
+#define SPINDLE_SYNC_MIN         0.001 // Min ratio, motion never fully stops
+#define SPINDLE_SYNC_MAX         1.5 // Max ratio, also limited by axis limits
+#define SPINDLE_SYNC_CORRECTION  100 // ms, time to make up phase lag
+#define SPINDLE_SYNC_MAX_LAG     0.05 // revs, motion behind spindle is an error
 
 // Input
-#define INPUT_BUFFER_LEN         128 // text buffer size (255 max)
+#define INPUT_BUFFER_LEN         255 // text buffer size (255 max)
+#define FIXED_POSITION_UNIT      0.0001 // mm or degrees, binary line targets
 
 
 // Report
 #define REPORT_RATE              250 // ms
+#define CREDIT_RATE              20  // ms
 
 
 // I2C
@@ -34,11 +34,11 @@
 #include "motor.h"
 
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 #include <util/delay.h>
 #include <math.h>
 
 
-#define DRIVERS MOTORS
 #define DRV8711_WORD_BYTE_PTR(WORD, LOW) (((uint8_t *)&(WORD)) + !(LOW))
 
 
@@ -53,6 +53,7 @@ typedef enum {
   SS_READ_OFF,
   SS_READ_STATUS,
   SS_CLEAR_STATUS,
+  SS_IDLE,
 } spi_state_t;
 
 
@@ -82,6 +83,7 @@ typedef struct {
 
   uint8_t microstep;
   uint8_t last_microstep;
+  bool last_enable;
 
   struct {
     uint16_t reg;
@@ -95,6 +97,8 @@ typedef struct {
   } stall;
 
   spi_state_t spi_state;
+  bool configured; // All registers written since reset or comm error
+  bool poll;       // Status read requested
 } drv8711_driver_t;
 
 
@@ -107,6 +111,7 @@ static drv8711_driver_t drivers[DRIVERS] = {
 
 
 typedef struct {
+  bool idle;
   bool advance;
   uint8_t disable_cs_pin;
 
@@ -200,11 +205,15 @@ static uint8_t _driver_ramp_torque(drv8711_driver_t *drv) {
     return target;
   }
 
-  // Ramp up
-  if (torque_ramp[drv->torque_step + 1] < target &&
-    32 < spi.bytes - drv->torque_bytes) {
-    drv->torque_step++;
-    drv->torque_bytes = spi.bytes;
+  // Ramp up.  Hold the current step until enough SPI bytes have passed.
+  // The torque register is rewritten until it reaches the target, which
+  // keeps the bus busy and so paces the ramp.
+  if (torque_ramp[drv->torque_step + 1] < target) {
+    if (32 < (uint8_t)(spi.bytes - drv->torque_bytes)) {
+      drv->torque_step++;
+      drv->torque_bytes = spi.bytes;
+    }
+
     return torque_ramp[drv->torque_step];
   }
 
@@ -213,21 +222,41 @@ static uint8_t _driver_ramp_torque(drv8711_driver_t *drv) {
 }
 
 
-static uint16_t _driver_get_torque_reg(drv8711_driver_t *drv) {
-  uint16_t reg;
-
+static uint16_t _driver_get_smplth(drv8711_driver_t *drv) {
   switch (drv->stall.samp_time) {
-  case 100:  reg = DRV8711_TORQUE_SMPLTH_100;  break;
-  case 200:  reg = DRV8711_TORQUE_SMPLTH_200;  break;
-  case 300:  reg = DRV8711_TORQUE_SMPLTH_300;  break;
-  case 400:  reg = DRV8711_TORQUE_SMPLTH_400;  break;
-  case 600:  reg = DRV8711_TORQUE_SMPLTH_600;  break;
-  case 800:  reg = DRV8711_TORQUE_SMPLTH_800;  break;
-  case 1000: reg = DRV8711_TORQUE_SMPLTH_1000; break;
-  default:   reg = DRV8711_TORQUE_SMPLTH_50;   break;
+  case 100:  return DRV8711_TORQUE_SMPLTH_100;
+  case 200:  return DRV8711_TORQUE_SMPLTH_200;
+  case 300:  return DRV8711_TORQUE_SMPLTH_300;
+  case 400:  return DRV8711_TORQUE_SMPLTH_400;
+  case 600:  return DRV8711_TORQUE_SMPLTH_600;
+  case 800:  return DRV8711_TORQUE_SMPLTH_800;
+  case 1000: return DRV8711_TORQUE_SMPLTH_1000;
+  default:   return DRV8711_TORQUE_SMPLTH_50;
   }
+}
+
 
-  return reg | _driver_ramp_torque(drv);
+static uint16_t _driver_get_torque_reg(drv8711_driver_t *drv) {
+  return _driver_get_smplth(drv) | _driver_ramp_torque(drv);
+}
+
+
+/// Returns the next register write needed to bring the driver up to date
+/// or the status read if one was requested.
+static spi_state_t _driver_spi_pending(drv8711_driver_t *drv) {
+  if (drv->stall.last_reg != drv->stall.reg) return SS_WRITE_STALL;
+
+  uint8_t torque = _driver_get_torque(drv);
+  if (drv->last_torque_reg != (_driver_get_smplth(drv) | torque))
+    return SS_WRITE_TORQUE;
+
+  if (drv->last_microstep != drv->microstep || drv->last_enable != !!torque)
+    return SS_WRITE_CTRL;
+
+  // Status must be read before it can be cleared
+  if (drv->poll || drv->reset_flags) return SS_READ_OFF;
+
+  return SS_IDLE;
 }
 
 
@@ -253,6 +282,7 @@ static uint16_t _driver_spi_command(drv8711_driver_t *drv) {
     // idling with the driver enabled.
     bool enable = _driver_get_torque(drv);
     drv->last_microstep = drv->microstep;
+    drv->last_enable = enable;
     return DRV8711_WRITE(DRV8711_CTRL_REG, DRV8711_CTRL | drv->microstep |
                          (enable ? DRV8711_CTRL_ENBL_bm : 0));
   }
@@ -264,6 +294,8 @@ static uint16_t _driver_spi_command(drv8711_driver_t *drv) {
     drv->reset_flags = false;
     drv->flags = 0;
     return DRV8711_WRITE(DRV8711_STATUS_REG, 0x0fff & ~drv->status);
+
+  case SS_IDLE: break;
   }
 
   return 0; // Should not get here
@@ -300,25 +332,44 @@ static spi_state_t _driver_spi_next(drv8711_driver_t *drv) {
   default: break;
   }
 
+  // Configuration writes every register in order
+  if (!drv->configured && drv->spi_state < SS_WRITE_CTRL)
+    return (spi_state_t)(drv->spi_state + 1); // Next
+
   switch (drv->spi_state) {
+  case SS_WRITE_CTRL: drv->configured = true; break;
+
   case SS_READ_OFF:
-    if (drv->flags & DRV8711_COMM_ERROR_bm) return SS_WRITE_OFF; // Retry
-    break;
+    if (drv->flags & DRV8711_COMM_ERROR_bm) {
+      drv->configured = false;
+      return SS_WRITE_OFF; // Retry
+    }
+    return SS_READ_STATUS;
 
   case SS_READ_STATUS:
+    drv->poll = false;
     if (drv->reset_flags) return SS_CLEAR_STATUS;
-    if (drv->stall.last_reg != drv->stall.reg) return SS_WRITE_STALL;
-    if (drv->last_torque_reg != _driver_get_torque_reg(drv))
-      return SS_WRITE_TORQUE;
-    if (drv->last_microstep != drv->microstep) return SS_WRITE_CTRL;
-    // Fall through
-
-  case SS_CLEAR_STATUS: return SS_READ_OFF;
+    break;
 
   default: break;
   }
 
-  return (spi_state_t)(drv->spi_state + 1); // Next
+  // Only send registers which changed
+  return _driver_spi_pending(drv);
+}
+
+
+/// Round robin to the next driver with SPI traffic pending, if any.
+static drv8711_driver_t *_spi_next_driver() {
+  for (int i = 0; i < DRIVERS; i++) {
+    if (++spi.driver == DRIVERS) spi.driver = 0; // Wrap around
+    drv8711_driver_t *drv = &drivers[spi.driver];
+
+    if (drv->spi_state == SS_IDLE) drv->spi_state = _driver_spi_pending(drv);
+    if (drv->spi_state != SS_IDLE) return drv;
+  }
+
+  return 0;
 }
 
 
@@ -338,10 +389,6 @@ static void _spi_send() {
 
     // Handle response and set next state
     drv->spi_state = _driver_spi_next(drv);
-
-    // Next driver
-    if (++spi.driver == DRIVERS) spi.driver = 0; // Wrap around
-    drv = &drivers[spi.driver];
   }
 
   // Disable CS
@@ -356,6 +403,14 @@ static void _spi_send() {
     spi.advance = true; // Word complete
 
   } else {
+    // Next driver or stop until there is more to send.  Atomic so a change
+    // made from a higher interrupt level cannot be missed by _spi_kick().
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      drv = _spi_next_driver();
+      if (!drv) spi.idle = true;
+    }
+    if (!drv) return;
+
     // Enable CS
     OUTSET_PIN(drv->cs_pin); // Set high (active)
     _delay_us(1);
@@ -376,6 +431,17 @@ static void _spi_send() {
 ISR(SPIC_INT_vect) {_spi_send();}
 
 
+/// Restart SPI traffic if it stopped.  The drivers' registers are only sent
+/// when they change so setters call this to send them right away.
+static void _spi_kick() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    if (spi.idle) {
+      spi.idle = false;
+      _spi_send();
+    }
+}
+
+
 static void _motor_fault_cb(io_function_t function, bool active) {
   motor_fault = active;
 }
@@ -413,9 +479,21 @@ void drv8711_init() {
 }
 
 
+/// Called every RTC tick to poll the drivers' status
+void drv8711_rtc_callback() {
+  for (int i = 0; i < DRIVERS; i++)
+    drivers[i].poll = true;
+
+  _spi_kick();
+}
+
+
 void drv8711_set_state(int driver, drv8711_state_t state) {
-  if (driver < 0 || DRIVERS <= driver) return;
+  if (driver < 0 || DRIVERS <= driver || drivers[driver].state == state)
+    return;
+
   drivers[driver].state = state;
+  _spi_kick();
 }
 
 
@@ -425,6 +503,7 @@ void drv8711_set_microsteps(int driver, uint16_t msteps) {
   if (microstep == 0xff) return; // Invalid
 
   drivers[driver].microstep = microstep;
+  _spi_kick();
 }
 
 
@@ -439,6 +518,7 @@ void drv8711_set_stall_detect(int driver, bool enable) {
   drv8711_driver_t *drv = &drivers[driver];
 
   drv->stall.detect = enable;
+  _spi_kick();
 
   if (enable) {
     drv->stall.save_microstep = motor_get_microstep(driver);
@@ -474,6 +554,7 @@ void set_drive_current(int driver, float value) {
   if (driver < 0 || DRIVERS <= driver || value < 0) return;
   if (DRV8711_MAX_CURRENT < value) value = DRV8711_MAX_CURRENT;
   _current_set(&drivers[driver].drive, value);
+  _spi_kick();
 }
 
 
@@ -488,6 +569,7 @@ void set_idle_current(int driver, float value) {
     return;
 
   _current_set(&drivers[driver].idle, value);
+  _spi_kick();
 }
 
 
@@ -501,12 +583,20 @@ bool get_motor_fault() {return motor_fault;}
 
 
 void set_driver_flags(int driver, uint16_t flags) {
+  if (driver < 0 || DRIVERS <= driver) return;
   drivers[driver].reset_flags = true;
+  _spi_kick();
 }
 
 
-uint16_t get_driver_flags(int driver) {return drivers[driver].flags;}
-bool get_driver_stalled(int driver) {return drivers[driver].stalled;}
+uint16_t get_driver_flags(int driver) {
+  return driver < DRIVERS ? drivers[driver].flags : 0;
+}
+
+
+bool get_driver_stalled(int driver) {
+  return driver < DRIVERS && drivers[driver].stalled;
+}
 
 
 float get_stall_volts(int driver) {
@@ -543,6 +633,7 @@ void set_stall_volts(int driver, float volts) {
   }
 
   drivers[driver].stall.reg = thresh | DRV8711_STALL_SDCNT_2 | vdiv;
+  _spi_kick();
 }
 
 
@@ -555,6 +646,7 @@ uint16_t get_stall_samp_time(int driver) {
 void set_stall_samp_time(int driver, uint16_t value) {
   if (driver < 0 || DRIVERS <= driver) return;
   drivers[driver].stall.samp_time = value;
+  _spi_kick();
 }
 
 
@@ -567,6 +659,7 @@ float get_stall_current(int driver) {
 void set_stall_current(int driver, float value) {
   if (driver < 0 || DRIVERS <= driver) return;
   _current_set(&drivers[driver].stall.current, value);
+  _spi_kick();
 }
 
 
@@ -195,6 +195,7 @@ typedef void (*stall_callback_t)(int driver);
 
 
 void drv8711_init();
+void drv8711_rtc_callback();
 void drv8711_remap_switches();
 void drv8711_set_state(int driver, drv8711_state_t state);
 void drv8711_set_microsteps(int driver, uint16_t msteps);
@@ -0,0 +1,139 @@
+/******************************************************************************\
+
+                  This file is part of the Buildbotics firmware.
+
+         Copyright (c) 2015 - 2023, Buildbotics LLC, All rights reserved.
+
+          This Source describes Open Hardware and is licensed under the
+                                  CERN-OHL-S v2.
+
+          You may redistribute and modify this Source and make products
+     using it under the terms of the CERN-OHL-S v2 (https:/cern.ch/cern-ohl).
+            This Source is distributed WITHOUT ANY EXPRESS OR IMPLIED
+     WARRANTY, INCLUDING OF MERCHANTABILITY, SATISFACTORY QUALITY AND FITNESS
+      FOR A PARTICULAR PURPOSE. Please see the CERN-OHL-S v2 for applicable
+                                   conditions.
+
+                 Source location: https://github.com/buildbotics
+
+       As per CERN-OHL-S v2 section 4, should You produce hardware based on
+     these sources, You must maintain the Source Location clearly visible on
+     the external case of the CNC Controller or other product you make using
+                                   this Source.
+
+                 For more information, email info@buildbotics.com
+
+\******************************************************************************/
+
+
+#include "encoder.h"
+
+#include "config.h"
+#include "io.h"
+
+#include <util/atomic.h>
+
+#include <stdint.h>
+
+
+// Quadrature decoder, each encoder reads A & B from remappable input pins
+typedef struct {
+  PORT_t *port_a;                // Zero when not mapped
+  PORT_t *port_b;
+  uint8_t bm_a;
+  uint8_t bm_b;
+  uint8_t state;                 // Last A & B levels
+  int32_t count;
+} encoder_t;
+
+
+static encoder_t encoders[ENCODERS] = {};
+
+
+// Count change indexed by the last and current A & B levels
+static const int8_t _qdec[16] = {
+  0, 1, -1, 0, -1, 0, 0, 1, 1, 0, 0, -1, 0, -1, 1, 0
+};
+
+
+static io_function_t _input(int encoder, bool b) {
+  return (io_function_t)(INPUT_ENCODER_0_A + 2 * encoder + b);
+}
+
+
+static uint8_t _read(const encoder_t &e) {
+  return (e.port_a->IN & e.bm_a ? 1 : 0) | (e.port_b->IN & e.bm_b ? 2 : 0);
+}
+
+
+/// Runs on any edge of any encoder input
+static void _decode() {
+  for (int i = 0; i < ENCODERS; i++) {
+    encoder_t &e = encoders[i];
+    if (!e.port_a) continue;
+
+    uint8_t state = _read(e);
+    e.count += _qdec[e.state << 2 | state];
+    e.state = state;
+  }
+}
+
+
+ISR(ENCODER_B_ISR_vect) {_decode();}
+ISR(ENCODER_F_ISR_vect) {_decode();}
+
+
+static void _enable(uint8_t pin) {
+  PORT_t *port = PIN_PORT(pin);
+  port->INT1MASK |= PIN_BM(pin);
+  port->INTCTRL = (port->INTCTRL & ~PORT_INT1LVL_gm) | PORT_INT1LVL_HI_gc;
+}
+
+
+void encoder_init() {encoder_map();}
+
+
+/// Configure decoding for the current IO map
+void encoder_map() {
+  PORTB.INTCTRL &= ~PORT_INT1LVL_gm;
+  PORTF.INTCTRL &= ~PORT_INT1LVL_gm;
+  PORTB.INT1MASK = PORTF.INT1MASK = 0;
+
+  for (int i = 0; i < ENCODERS; i++) {
+    encoder_t &e = encoders[i];
+    bool level;
+    uint8_t pin_a = io_get_input_pin(_input(i, false), &level);
+    uint8_t pin_b = io_get_input_pin(_input(i, true), &level);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      e.port_a = 0;
+
+      if (pin_a && pin_b) {
+        e.port_b = PIN_PORT(pin_b);
+        e.bm_a = PIN_BM(pin_a);
+        e.bm_b = PIN_BM(pin_b);
+        e.port_a = PIN_PORT(pin_a);
+        e.state = _read(e);
+      }
+    }
+
+    if (e.port_a) {
+      _enable(pin_a);
+      _enable(pin_b);
+    }
+  }
+}
+
+
+bool encoder_is_enabled(int encoder) {
+  return encoder < ENCODERS && encoders[encoder].port_a;
+}
+
+
+int32_t encoder_get_count(int encoder) {
+  if (ENCODERS <= encoder) return 0;
+
+  int32_t count;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) count = encoders[encoder].count;
+  return count;
+}
@@ -50,7 +50,13 @@ static struct {
   float peak_vel;
   float peak_accel;
 
-  float feed_override;
+  float feed_override;  // Requested
+  float override;       // Applied, ramps toward the requested override
+  float override_rate;
+
+  uint8_t seg_ms;     // Current segment time
+  uint8_t seg_min_ms; // Used while accelerating
+  uint8_t seg_max_ms; // Used while cruising
 
   struct {
     float target[AXES];
@@ -67,7 +73,10 @@ static struct {
 
 void exec_init() {
   memset(&ex, 0, sizeof(ex));
-  ex.feed_override = 1;
+  ex.feed_override = ex.override = 1;
+  ex.seg_ms = SEGMENT_MS;
+  ex.seg_max_ms = SEGMENT_MAX_MS;
+  ex.seg_min_ms = SEGMENT_MIN_MS;
 }
 
 
@@ -79,6 +88,12 @@ void exec_get_position(float p[AXES]) {
 float exec_get_axis_position(int axis) {return ex.position[axis];}
 
 
+// Position at the end of the last segment, which may not yet be complete
+void exec_get_end_position(float p[AXES]) {
+  memcpy(p, ex.seg.time ? ex.seg.target : ex.position, sizeof(ex.position));
+}
+
+
 void exec_set_velocity(float v) {
   ex.velocity = v;
   if (ex.peak_vel < v) ex.peak_vel = v;
@@ -98,6 +113,53 @@ float exec_get_acceleration() {return ex.accel;}
 void exec_set_jerk(float j) {ex.jerk = j;}
 
 
+static float _segment_time() {return ex.seg_ms * (1.0 / 60000);}
+
+
+// Selects the next segment time, shorter segments give a finer velocity
+// profile while accelerating at the cost of more exec time
+float exec_segment_time(bool accel) {
+  ex.seg_ms = accel ? ex.seg_min_ms : ex.seg_max_ms;
+  return _segment_time();
+}
+
+
+uint8_t exec_get_segment_ms() {return ex.seg_ms;}
+
+
+// Moves the applied feed override toward the requested one with limited rate
+// of change and jerk so velocity changes smoothly
+static void _ramp_override(float t) {
+  float target = ex.feed_override;
+  if (ex.override == target && !ex.override_rate) return;
+
+  float rate = SCurve::nextAccel(t, target, ex.override, ex.override_rate,
+                                 FEED_OVERRIDE_ACCEL, FEED_OVERRIDE_JERK);
+  float delta = rate * t;
+
+  // Don't overshoot
+  if ((delta < 0 && ex.override + delta < target && target < ex.override) ||
+      (0 < delta && ex.override < target && target < ex.override + delta)) {
+    ex.override = target;
+    ex.override_rate = 0;
+
+  } else {
+    ex.override += delta;
+    ex.override_rate = rate;
+  }
+}
+
+
+/// Advances time by @param t and returns the plan time executed per unit of
+/// real time, at most @param max_scale.  Spindle synchronized feeds ignore the
+/// feed override.
+float exec_next_time_scale(float t, float max_scale) {
+  _ramp_override(t);
+  float scale = spindle_is_synced() ? spindle_get_sync_scale() : ex.override;
+  return scale < max_scale ? scale : max_scale;
+}
+
+
 void exec_set_cb(exec_cb_t cb) {ex.cb = cb;}
 
 
@@ -110,30 +172,37 @@ void exec_move_to_target(const float target[]) {
   // Prep power updates
   st_prep_power(ex.seg.power_updates);
 
-  // Shift power updates
-  for (unsigned i = 0; i < POWER_MAX_UPDATES; i++) {
-    ex.seg.power_updates[i] = ex.seg.power_updates[i + POWER_MAX_UPDATES];
-    ex.seg.power_updates[i + POWER_MAX_UPDATES].state = POWER_IGNORE;
-  }
+  // Shift power updates by the segment time
+  const unsigned count = 2 * POWER_MAX_UPDATES;
+  for (unsigned i = 0; i < count; i++)
+    if (i + ex.seg_ms < count)
+      ex.seg.power_updates[i] = ex.seg.power_updates[i + ex.seg_ms];
+    else {
+      ex.seg.power_updates[i].state = POWER_IGNORE;
+      ex.seg.power_updates[i].outputs_on = 0;
+      ex.seg.power_updates[i].outputs_off = 0;
+      ex.seg.power_updates[i].raster = false;
+    }
 
   // Update position
   copy_vector(ex.position, target);
 
   // Call the stepper prep function
-  st_prep_line(target);
+  st_prep_line(target, ex.seg_ms);
 }
 
 
 stat_t _segment_exec() {
+  const float seg_time = _segment_time();
   float t = ex.seg.time;
   float v = ex.seg.vel;
   float a = ex.seg.accel;
 
   // Handle pause
   if (state_get() == STATE_STOPPING) {
-    a = SCurve::nextAccel(SEGMENT_TIME, 0, ex.velocity, ex.accel,
+    a = SCurve::nextAccel(seg_time, 0, ex.velocity, ex.accel,
                           ex.seg.max_accel, ex.seg.max_jerk);
-    v = ex.velocity + SEGMENT_TIME * a;
+    v = ex.velocity + seg_time * a;
     t *= ex.seg.vel / v;
 
     if (v < MIN_VELOCITY) {
@@ -147,7 +216,7 @@ stat_t _segment_exec() {
   }
 
   // Wait for next seg if time is too short and we are still moving
-  if (t < SEGMENT_TIME && (!t || v)) {
+  if (t < seg_time && (!t || v)) {
     if (!v) {
       exec_set_velocity(0);
       exec_set_acceleration(0);
@@ -162,14 +231,14 @@ stat_t _segment_exec() {
   exec_set_velocity(v);
   exec_set_acceleration(a);
 
-  if (t <= SEGMENT_TIME) {
+  if (t <= seg_time) {
     // Move
     exec_move_to_target(ex.seg.target);
     ex.seg.time = 0;
 
   } else {
     // Compute next target
-    float ratio = SEGMENT_TIME / t;
+    float ratio = seg_time / t;
     float target[AXES];
     for (int axis = 0; axis < AXES; axis++) {
       float diff = ex.seg.target[axis] - ex.position[axis];
@@ -180,8 +249,8 @@ stat_t _segment_exec() {
     exec_move_to_target(target);
 
     // Update time
-    if (t == ex.seg.time) ex.seg.time -= SEGMENT_TIME;
-    else ex.seg.time -= SEGMENT_TIME * v / ex.seg.vel;
+    if (t == ex.seg.time) ex.seg.time -= seg_time;
+    else ex.seg.time -= seg_time * v / ex.seg.vel;
   }
 
   // Check switch
@@ -198,13 +267,23 @@ stat_t exec_segment(float time, const float target[], float vel, float accel,
   float nextT       = ex.seg.time + time;
   const float stepT = 1.0 / 60000; // 1ms in mins
   float t           = 0.5 / 60000; // 0.5ms in mins
+  unsigned i        = 0;
   unsigned j        = 0;
 
-  for (unsigned i = 0; t < nextT && j < POWER_MAX_UPDATES; i++) {
+  for (; t < nextT && j < POWER_MAX_UPDATES; i++) {
     if (ex.seg.time < t) ex.seg.power_updates[i] = power_updates[j++];
     t += stepT;
   }
 
+  // Power updates which did not fit can be dropped but output changes cannot
+  power_update_t *last = &ex.seg.power_updates[i ? i - 1 : 0];
+  for (; j < ex.seg_ms && j < POWER_MAX_UPDATES; j++) {
+    uint16_t on = power_updates[j].outputs_on;
+    uint16_t off = power_updates[j].outputs_off;
+    last->outputs_on = (last->outputs_on & ~off) | on;
+    last->outputs_off = (last->outputs_off & ~on) | off;
+  }
+
   copy_vector(ex.seg.target, target);
   ex.seg.time      = nextT;
   ex.seg.vel       = vel;
@@ -236,7 +315,7 @@ stat_t exec_next() {
 
 
 // Variable callbacks
-float get_axis_position(int axis)    {return ex.position[axis];}
+float get_axis_position(int axis)    {return st_get_axis_position(axis);}
 float get_velocity()                 {return ex.velocity / VELOCITY_MULTIPLIER;}
 float get_acceleration()             {return ex.accel / ACCEL_MULTIPLIER;}
 float get_jerk()                     {return ex.jerk / JERK_MULTIPLIER;}
@@ -245,7 +324,26 @@ void  set_peak_vel(float x)          {ex.peak_vel = 0;}
 float get_peak_accel()               {return ex.peak_accel / ACCEL_MULTIPLIER;}
 void  set_peak_accel(float x)        {ex.peak_accel = 0;}
 float get_feed_override()            {return ex.feed_override;}
-void  set_feed_override(float value) {ex.feed_override = value;}
+uint8_t get_seg_max_ms()             {return ex.seg_max_ms;}
+uint8_t get_seg_min_ms()             {return ex.seg_min_ms;}
+
+
+void set_feed_override(float value) {
+  if (!isfinite(value)) return;
+  if (value < FEED_OVERRIDE_MIN) value = FEED_OVERRIDE_MIN;
+  if (FEED_OVERRIDE_MAX < value) value = FEED_OVERRIDE_MAX;
+  ex.feed_override = value;
+}
+
+
+void set_seg_max_ms(uint8_t ms) {
+  if (ex.seg_min_ms <= ms && ms <= SEGMENT_MAX_MS) ex.seg_max_ms = ms;
+}
+
+
+void set_seg_min_ms(uint8_t ms) {
+  if (ms && ms <= ex.seg_max_ms) ex.seg_min_ms = ms;
+}
 
 
 // Command callbacks
@@ -286,11 +384,19 @@ unsigned command_set_axis_size() {return sizeof(set_axis_t);}
 void command_set_axis_exec(void *data) {
   set_axis_t *cmd = (set_axis_t *)data;
 
+  // The position is set at the end of the last line.  If a partial segment
+  // of that line is still to run, shift it so it ends at the new position.
+  float position = cmd->position;
+  if (ex.seg.time) {
+    position += ex.position[cmd->axis] - ex.seg.target[cmd->axis];
+    ex.seg.target[cmd->axis] = cmd->position;
+  }
+
   // Update exec
-  ex.position[cmd->axis] = cmd->position;
+  ex.position[cmd->axis] = position;
 
   // Update motors
   for (int motor = 0; motor < MOTORS; motor++)
     if (motor_get_axis(motor) == cmd->axis)
-      motor_set_position(motor, cmd->position);
+      motor_set_position(motor, position);
 }
@@ -43,12 +43,16 @@ void exec_init();
 
 void exec_get_position(float p[AXES]);
 float exec_get_axis_position(int axis);
+void exec_get_end_position(float p[AXES]);
 float exec_get_power_scale();
 void exec_set_velocity(float v);
 float exec_get_velocity();
 void exec_set_acceleration(float a);
 float exec_get_acceleration();
 void exec_set_jerk(float j);
+float exec_segment_time(bool accel);
+uint8_t exec_get_segment_ms();
+float exec_next_time_scale(float t, float max_scale);
 
 void exec_set_cb(exec_cb_t cb);
 
@@ -26,6 +26,7 @@
 \******************************************************************************/
 
 #include "i2c.h"
+#include "timing.h"
 
 #include <avr/interrupt.h>
 
@@ -68,14 +69,14 @@ static void _i2c_command_byte(uint8_t byte) {
 
 
 ISR(I2C_ISR) {
+  uint32_t start = timing_now();
   uint8_t status = I2C_DEV.SLAVE.STATUS;
 
   // Error or collision
-  if (status & (TWI_SLAVE_BUSERR_bm | TWI_SLAVE_COLL_bm)) {
-    _i2c_reset_command();
-    return; // Ignore
+  if (status & (TWI_SLAVE_BUSERR_bm | TWI_SLAVE_COLL_bm))
+    _i2c_reset_command(); // Ignore
 
-  } else if ((status & TWI_SLAVE_APIF_bm) && (status & TWI_SLAVE_AP_bm)) {
+  else if ((status & TWI_SLAVE_APIF_bm) && (status & TWI_SLAVE_AP_bm)) {
     // START + address match
     I2C_DEV.SLAVE.CTRLB = TWI_SLAVE_CMD_RESPONSE_gc; // ACK address byte
     _i2c_end_command(); // Handle repeated START
@@ -108,6 +109,8 @@ ISR(I2C_ISR) {
       I2C_DEV.SLAVE.CTRLB = TWI_SLAVE_CMD_RESPONSE_gc;
     }
   }
+
+  timing_record(TIMING_I2C, start);
 }
 
 
@@ -27,6 +27,7 @@
 
 #include "io.h"
 #include "config.h"
+#include "encoder.h"
 
 #include <stdint.h>
 #include <string.h>
@@ -156,6 +157,11 @@ static bool _is_valid(io_function_t function, io_type_t type) {
 }
 
 
+static bool _is_encoder(io_function_t function) {
+  return INPUT_ENCODER_0_A <= function && function <= INPUT_ENCODER_3_B;
+}
+
+
 static void _state_set_active(io_function_t function, bool active) {
   if (!_is_valid(function, IO_TYPE_INPUT)) return;
 
@@ -350,11 +356,15 @@ io_type_t io_get_type(io_function_t function) {
   case INPUT_MOTOR_2_MIN: case INPUT_MOTOR_3_MIN:
   case INPUT_0: case INPUT_1: case INPUT_2: case INPUT_3:
   case INPUT_ESTOP: case INPUT_PROBE:
+  case INPUT_ENCODER_0_A: case INPUT_ENCODER_0_B: case INPUT_ENCODER_1_A:
+  case INPUT_ENCODER_1_B: case INPUT_ENCODER_2_A: case INPUT_ENCODER_2_B:
+  case INPUT_ENCODER_3_A: case INPUT_ENCODER_3_B:
     return IO_TYPE_INPUT;
 
   case OUTPUT_0: case OUTPUT_1: case OUTPUT_2: case OUTPUT_3:
   case OUTPUT_MIST: case OUTPUT_FLOOD: case OUTPUT_FAULT:
   case OUTPUT_TOOL_ENABLE: case OUTPUT_TOOL_DIRECTION:
+  case OUTPUT_STEP_4: case OUTPUT_DIR_4:
     return IO_TYPE_OUTPUT;
 
   case ANALOG_0: case ANALOG_1: case ANALOG_2: case ANALOG_3:
@@ -409,12 +419,46 @@ io_function_t io_get_port_function(bool digital, uint8_t port) {
 }
 
 
+io_function_t io_get_output_function(int index) {
+  return _output_to_function(index);
+}
+
+
 uint8_t io_get_input(io_function_t function) {
   if (!_is_valid(function, IO_TYPE_INPUT)) return IO_TRI;
   return !!_func_state[function].active;
 }
 
 
+static io_pin_t *_find_pin(io_function_t function, io_type_t type) {
+  if (!_is_valid(function, type)) return 0;
+
+  for (int i = 0; _pins[i].pin; i++)
+    if (_pins[i].function == function && (_pins[i].types & type))
+      return &_pins[i];
+
+  return 0;
+}
+
+
+/// Returns the first pin mapped to an input and the pin level at which that
+/// input is active or zero if there is no such pin.
+uint8_t io_get_input_pin(io_function_t function, bool *active_level) {
+  io_pin_t *pin = _find_pin(function, IO_TYPE_INPUT);
+  if (!pin) return 0;
+
+  *active_level = pin->mode == NORMALLY_CLOSED;
+  return pin->pin;
+}
+
+
+/// Returns the first pin mapped to an output or zero if there is no such pin.
+uint8_t io_get_output_pin(io_function_t function) {
+  io_pin_t *pin = _find_pin(function, IO_TYPE_OUTPUT);
+  return pin ? pin->pin : 0;
+}
+
+
 float io_get_analog(io_function_t function) {
   if (!_is_valid(function, IO_TYPE_ANALOG)) return 0;
   return _analog_ports[_function_to_analog_port(function)];
@@ -426,8 +470,9 @@ void io_rtc_callback() {
   for (int i = 0; _pins[i].pin; i++) {
     io_pin_t *pin = &_pins[i];
 
-    // Digital input
-    if (_is_valid(pin->function, IO_TYPE_INPUT)) {
+    // Digital input, encoders are decoded in encoder.c
+    if (_is_valid(pin->function, IO_TYPE_INPUT) &&
+        !_is_encoder(pin->function)) {
       io_input_t *input = &pin->input;
 
       if (input->lockout && --input->lockout) continue;
@@ -484,6 +529,7 @@ void set_io_function(int index, uint8_t function) {
       _pins[index].function == function) return;
 
   _set_function(&_pins[index], (io_function_t)function);
+  encoder_map();
 }
 
 
@@ -527,8 +573,19 @@ void set_input_lockout(uint16_t lockout) {
 
 
 uint16_t get_input_lockout() {return _io.lockout;}
-uint8_t get_min_input(int axis) {return _get_state(MIN_INPUT(axis));}
-uint8_t get_max_input(int axis) {return _get_state(MAX_INPUT(axis));}
+
+
+// Only motors with on board drivers have switch inputs
+uint8_t get_min_input(int axis) {
+  return axis < DRIVERS ? _get_state(MIN_INPUT(axis)) : IO_INVALID;
+}
+
+
+uint8_t get_max_input(int axis) {
+  return axis < DRIVERS ? _get_state(MAX_INPUT(axis)) : IO_INVALID;
+}
+
+
 uint8_t get_input(int index) {return _get_state(_input_to_function(index));}
 
 
@@ -41,6 +41,9 @@ typedef enum {
   OUTPUT_0, OUTPUT_1, OUTPUT_2, OUTPUT_3, OUTPUT_MIST, OUTPUT_FLOOD,
   OUTPUT_FAULT, OUTPUT_TOOL_ENABLE, OUTPUT_TOOL_DIRECTION,
   ANALOG_0, ANALOG_1, ANALOG_2, ANALOG_3,
+  OUTPUT_STEP_4, OUTPUT_DIR_4,
+  INPUT_ENCODER_0_A, INPUT_ENCODER_0_B, INPUT_ENCODER_1_A, INPUT_ENCODER_1_B,
+  INPUT_ENCODER_2_A, INPUT_ENCODER_2_B, INPUT_ENCODER_3_A, INPUT_ENCODER_3_B,
 
   // Hard wired functions
   INPUT_STALL_0, INPUT_STALL_1, INPUT_STALL_2, INPUT_STALL_3, INPUT_MOTOR_FAULT,
@@ -79,6 +82,9 @@ io_callback_t io_get_callback(io_function_t function);
 void io_set_output(io_function_t function, bool active);
 void io_stop_outputs();
 io_function_t io_get_port_function(bool digital, uint8_t port);
+io_function_t io_get_output_function(int index);
 uint8_t io_get_input(io_function_t function);
+uint8_t io_get_input_pin(io_function_t function, bool *active_level);
+uint8_t io_get_output_pin(io_function_t function);
 float io_get_analog(io_function_t function);
 void io_rtc_callback();
@@ -64,6 +64,7 @@ stat_t jog_exec() {
   // Compute per axis velocities and target positions
   float target[AXES] = {0,};
   float velocity_sqr = 0;
+  const float segTime = exec_segment_time(false);
 
   for (int axis = 0; axis < AXES; axis++) {
     if (!axis_is_enabled(axis)) continue;
@@ -89,10 +90,10 @@ stat_t jog_exec() {
     }
 
     // Compute next velocity
-    float v = jr.scurves[axis].next(SEGMENT_TIME, targetV);
+    float v = jr.scurves[axis].next(segTime, targetV);
 
     // Don't overshoot soft limits
-    float deltaP = v * SEGMENT_TIME;
+    float deltaP = v * segTime;
     if (softLimited && 0 < deltaP && max < p + deltaP) p = max;
     else if (softLimited && deltaP < 0 && p + deltaP < min) p = min;
     else p += deltaP;
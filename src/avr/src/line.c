@@ -25,8 +25,11 @@
 
 \******************************************************************************/
 
+#include "line.h"
+
 #include "config.h"
 #include "exec.h"
+#include "axis.h"
 #include "command.h"
 #include "spindle.h"
 #include "util.h"
@@ -35,6 +38,7 @@
 #include <math.h>
 #include <float.h>
 #include <string.h>
+#include <stddef.h>
 
 
 typedef struct {
@@ -50,6 +54,40 @@ typedef struct {
 } line_t;
 
 
+// Queued lines omit the start position, which is where the previous move
+// ended, unmoved axes and zero times.  The rest is computed at exec.
+typedef struct {
+  float target_vel;
+  float max_accel;
+  float max_jerk;
+  uint8_t axes;  // Axes present in values
+  uint8_t times; // Times present in values
+  float values[AXES + 7]; // Axis targets then times
+} packed_line_t;
+
+
+// Binary lines carry the id of the command
+typedef struct {
+  uint16_t id;
+  packed_line_t line;
+} binary_line_t;
+
+
+// Binary line flags, the low bits are the axis and time masks
+#define LINE_TIMES_bp  6
+#define LINE_LIMITS_bm (1 << 13) // Max accel and jerk present
+#define LINE_FIXED_bm  (1 << 14) // Axes are varints in FIXED_POSITION_UNIT
+#define LINE_DELTA_bm  (1 << 15) // Fixed axes are relative to last target
+
+
+// Binary line max accel and jerk, omitted when unchanged
+static struct {
+  bool valid;
+  float max_accel;
+  float max_jerk;
+} limits;
+
+
 static struct {
   line_t line;
 
@@ -62,6 +100,8 @@ static struct {
   float jerk;
   float lV; // Last velocity
   float lD; // Last distance
+  float max_scale; // Max time scale within the axis limits
+
 
   power_update_t power_updates[POWER_MAX_UPDATES];
 } l;
@@ -69,22 +109,17 @@ static struct {
 
 static void _segment_target(float target[AXES], float d) {
   for (int axis = 0; axis < AXES; axis++)
-    target[axis] = l.line.start[axis] + l.line.unit[axis] * d;
-}
-
-
-static float _segment_distance(float t) {
-  return l.iD + SCurve::distance(t, l.iV, l.iA, l.jerk);
+    target[axis] = l.line.unit[axis] ?
+      l.line.start[axis] + l.line.unit[axis] * d : l.line.start[axis];
 }
 
 
-static float _segment_velocity(float t) {
-  return l.iV + SCurve::velocity(t, l.iA, l.jerk);
-}
-
-
-static float _segment_accel(float t) {
-  return l.iA + SCurve::acceleration(t, l.jerk);
+// Computes segment distance, velocity and acceleration
+static void _segment_eval(float t, float &d, float &v, float &a) {
+  SCurve::evaluate(t, l.iV, l.iA, l.jerk, d, v, a);
+  d += l.iD;
+  v += l.iV;
+  a += l.iA;
 }
 
 
@@ -122,27 +157,31 @@ static stat_t _exec_segment(float time, const float target[], float vel,
 
 
 static stat_t _line_exec() {
-  // Compute times
+  // Compute times, plan time may run slower or faster than real time
   float section_time = l.line.times[l.section];
-  float seg_time = SEGMENT_TIME;
-  l.t += seg_time;
+  float seg_time = exec_segment_time(l.section != 3); // 3 is constant vel
+  float scale = exec_next_time_scale(seg_time, l.max_scale);
+  float plan_time = seg_time * scale;
+  l.t += plan_time;
 
   // Don't exceed section time
   if (section_time < l.t) {
-    seg_time = section_time - (l.t - seg_time);
+    plan_time = section_time - (l.t - plan_time);
+    seg_time = plan_time / scale;
     l.t = section_time;
   }
 
+  spindle_sync_advance(plan_time, seg_time);
+
   // Compute distance, velocity and acceleration
-  float d = _segment_distance(l.t);
-  float v = _segment_velocity(l.t);
-  float a = _segment_accel(l.t);
+  float d, v, a;
+  _segment_eval(l.t, d, v, a);
 
   // Don't allow overshoot
   if (l.line.length < d) d = l.line.length;
 
   // Handle synchronous speeds
-  spindle_load_power_updates(l.power_updates, l.lD, d);
+  spindle_load_power_updates(l.power_updates, exec_get_segment_ms(), l.lD, d);
   l.lD = d;
 
   // Check if section complete
@@ -158,7 +197,8 @@ static stat_t _line_exec() {
 
       // Last segment of last section
       // Use exact target values to correct for floating-point errors
-      return _exec_segment(seg_time, l.line.target, l.line.target_vel, a);
+      return _exec_segment(seg_time, l.line.target,
+                           l.line.target_vel * scale, a * scale * scale);
     }
   }
 
@@ -166,38 +206,108 @@ static stat_t _line_exec() {
   float target[AXES];
   _segment_target(target, d);
 
-  // Segment move
-  return _exec_segment(seg_time, target, v, a);
+  // Segment move, report real time velocity and acceleration
+  return _exec_segment(seg_time, target, v * scale, a * scale * scale);
+}
+
+
+static void _line_init(line_t *line) {
+  // Compute direction vector
+  line->length = 0;
+  for (int axis = 0; axis < AXES; axis++) {
+    line->unit[axis] = line->target[axis] - line->start[axis];
+    line->length += line->unit[axis] * line->unit[axis];
+  }
+
+  line->length = sqrt(line->length);
+  for (int axis = 0; axis < AXES; axis++)
+    if (line->unit[axis]) line->unit[axis] /= line->length;
+}
+
+
+// Packs the moved axes and nonzero times, returns false if all times are zero
+static bool _line_pack(packed_line_t *line, const float start[AXES],
+                       const float target[AXES], const float times[7]) {
+  float *v = line->values;
+
+  for (int axis = 0; axis < AXES; axis++)
+    if (target[axis] != start[axis]) {
+      line->axes |= 1 << axis;
+      *v++ = target[axis];
+    }
+
+  for (int i = 0; i < 7; i++)
+    if (times[i]) {
+      line->times |= 1 << i;
+      *v++ = times[i];
+    }
+
+  return line->times;
 }
 
 
+static unsigned _line_size(const packed_line_t *line) {
+  unsigned count = 0;
+
+  for (uint8_t bits = line->axes; bits; bits >>= 1) count += bits & 1;
+  for (uint8_t bits = line->times; bits; bits >>= 1) count += bits & 1;
+
+  return offsetof(packed_line_t, values) + count * sizeof(float);
+}
+
+
+static void _line_unpack(const packed_line_t *packed, line_t *line) {
+  const float *v = packed->values;
+
+  exec_get_end_position(line->start);
+
+  for (int axis = 0; axis < AXES; axis++)
+    line->target[axis] =
+      (packed->axes & (1 << axis)) ? *v++ : line->start[axis];
+
+  for (int i = 0; i < 7; i++)
+    line->times[i] = (packed->times & (1 << i)) ? *v++ : 0;
+
+  line->target_vel = packed->target_vel;
+  line->max_accel = packed->max_accel;
+  line->max_jerk = packed->max_jerk;
+
+  _line_init(line);
+}
+
+
+void line_flush() {limits.valid = false;}
+
+
 stat_t command_line(char *cmd) {
-  line_t line = {};
+  packed_line_t *line = (packed_line_t *)command_reserve(COMMAND_line);
+  float start[AXES];
+  float target[AXES];
+  float times[7] = {0,};
 
   cmd++; // Skip command code
 
   // Get start position
-  command_get_position(line.start);
+  command_get_position(start);
 
   // Get target velocity
-  if (!decode_float(&cmd, &line.target_vel)) return STAT_BAD_FLOAT;
-  if (line.target_vel < 0) return STAT_INVALID_ARGUMENTS;
+  if (!decode_float(&cmd, &line->target_vel)) return STAT_BAD_FLOAT;
+  if (line->target_vel < 0) return STAT_INVALID_ARGUMENTS;
 
   // Get max accel
-  if (!decode_float(&cmd, &line.max_accel)) return STAT_BAD_FLOAT;
-  if (line.max_accel < 0) return STAT_INVALID_ARGUMENTS;
+  if (!decode_float(&cmd, &line->max_accel)) return STAT_BAD_FLOAT;
+  if (line->max_accel < 0) return STAT_INVALID_ARGUMENTS;
 
   // Get max jerk
-  if (!decode_float(&cmd, &line.max_jerk)) return STAT_BAD_FLOAT;
-  if (line.max_jerk < 0) return STAT_INVALID_ARGUMENTS;
+  if (!decode_float(&cmd, &line->max_jerk)) return STAT_BAD_FLOAT;
+  if (line->max_jerk < 0) return STAT_INVALID_ARGUMENTS;
 
   // Get target position
-  copy_vector(line.target, line.start);
-  stat_t status = decode_axes(&cmd, line.target);
+  copy_vector(target, start);
+  stat_t status = decode_axes(&cmd, target);
   if (status) return status;
 
   // Get times
-  bool has_time = false;
   while (*cmd) {
     if (*cmd < '0' || '6' < *cmd) break;
     int section = *cmd - '0';
@@ -207,40 +317,66 @@ stat_t command_line(char *cmd) {
     if (!decode_float(&cmd, &time)) return STAT_BAD_FLOAT;
 
     if (time < 0) return STAT_NEGATIVE_SCURVE_TIME;
-    line.times[section] = time;
-    if (time) has_time = true;
+    times[section] = time;
    }
 
-  if (!has_time) return STAT_ALL_ZERO_SCURVE_TIMES;
-
   // Check for end of command
   if (*cmd) return STAT_INVALID_ARGUMENTS;
 
-  // Set next start position
-  command_set_position(line.target);
-
-  // Compute direction vector
-  for (int axis = 0; axis < AXES; axis++) {
-    line.unit[axis] = line.target[axis] - line.start[axis];
-    line.length += line.unit[axis] * line.unit[axis];
-  }
+  if (!_line_pack(line, start, target, times))
+    return STAT_ALL_ZERO_SCURVE_TIMES;
 
-  line.length = sqrt(line.length);
-  for (int axis = 0; axis < AXES; axis++)
-    if (line.unit[axis]) line.unit[axis] /= line.length;
+  // Set next start position
+  command_set_position(target);
 
   // Queue
-  command_push(COMMAND_line, &line);
+  command_commit(_line_size(line));
 
   return STAT_OK;
 }
 
 
-unsigned command_line_size() {return sizeof(line_t);}
+unsigned command_line_size() {return sizeof(packed_line_t);}
+
+
+// Largest time scale which keeps the line within its axes' limits.  Scaling
+// plan time scales velocity, acceleration and jerk by the scale, its square
+// and its cube.
+static float _max_scale(const line_t &line, float iV) {
+  float maxV = INFINITY, maxA = INFINITY, maxJ = INFINITY;
+
+  for (int axis = 0; axis < AXES; axis++) {
+    float u = fabs(line.unit[axis]);
+    if (!u) continue;
+
+    float v = axis_get_velocity_max(axis) / u;
+    float a = axis_get_accel_max(axis) / u;
+    float j = axis_get_jerk_max(axis) / u;
+
+    if (v && v < maxV) maxV = v;
+    if (a && a < maxA) maxA = a;
+    if (j && j < maxJ) maxJ = j;
+  }
+
+  // Peak velocity, accel and jerk of the plan
+  const float *t = line.times;
+  float j = line.max_jerk;
+  float a = j * t[0];
+  float v = iV + 0.5 * a * t[0] + a * t[1] + a * t[2] - 0.5 * j * t[2] * t[2];
+  if (v < iV) v = iV;
+  if (a < j * t[4]) a = j * t[4];
+  if (!t[0] && !t[2] && !t[4] && !t[6]) j = 0;
+
+  float scale = v ? maxV / v : INFINITY;
+  if (a && maxA < scale * scale * a) scale = sqrt(maxA / a);
+  if (j && maxJ < scale * scale * scale * j) scale = cbrt(maxJ / j);
+
+  return scale < 1 ? 1 : scale;
+}
 
 
 void command_line_exec(void *data) {
-  l.line = *(line_t *)data;
+  _line_unpack((packed_line_t *)data, &l.line);
 
   // Setup first section
   l.t = 0;
@@ -254,21 +390,255 @@ void command_line_exec(void *data) {
   l.section = -1;
   if (!_section_next()) return;
 
-#if 0
-  // Compare start position to actual position
-  float diff[AXES];
-  bool report = false;
-  exec_get_position(diff);
-  for (int i = 0; i < AXES; i++) {
-    diff[i] -= l.line.start[i];
-    if (0.1 < fabs(diff[i])) report = true;
-  }
-
-  if (report)
-    STATUS_DEBUG("diff: %.4f %.4f %.4f %.4f",
-                 diff[0], diff[1], diff[2], diff[3]);
-#endif
+  l.max_scale = _max_scale(l.line, l.iV);
 
   // Set callback
   exec_set_cb(_line_exec);
 }
+
+
+// Binary frame decode state.  Targets and limits are only applied once the
+// whole frame is valid, so a rejected frame leaves the position untouched.
+typedef struct {
+  float position[AXES];
+  int32_t fixed[AXES];
+  uint8_t fixed_valid; // Axes with a valid fixed position
+  uint8_t changed;     // Axes with new targets
+
+  bool limits_valid;
+  float max_accel;
+  float max_jerk;
+} frame_state_t;
+
+
+static void _frame_begin(frame_state_t *fs) {
+  command_get_position(fs->position);
+  fs->fixed_valid = fs->changed = 0;
+
+  for (int axis = 0; axis < AXES; axis++)
+    if (command_get_fixed_position(axis, &fs->fixed[axis]))
+      fs->fixed_valid |= 1 << axis;
+
+  fs->limits_valid = limits.valid;
+  fs->max_accel = limits.max_accel;
+  fs->max_jerk = limits.max_jerk;
+}
+
+
+static void _frame_commit(const frame_state_t *fs) {
+  for (int axis = 0; axis < AXES; axis++)
+    if (fs->changed & (1 << axis)) {
+      if (fs->fixed_valid & (1 << axis))
+        command_set_fixed_position(axis, fs->fixed[axis]);
+      else command_set_axis_position(axis, fs->position[axis]);
+    }
+
+  limits.valid = fs->limits_valid;
+  limits.max_accel = fs->max_accel;
+  limits.max_jerk = fs->max_jerk;
+}
+
+
+static stat_t _decode_limits(const uint8_t **s, const uint8_t *end,
+                             frame_state_t *fs) {
+  fs->limits_valid = decode_binary(s, end, &fs->max_accel, 4) &&
+    decode_binary(s, end, &fs->max_jerk, 4) &&
+    isfinite(fs->max_accel) && 0 <= fs->max_accel &&
+    isfinite(fs->max_jerk) && 0 <= fs->max_jerk;
+
+  return fs->limits_valid ? STAT_OK : STAT_INVALID_ARGUMENTS;
+}
+
+
+static stat_t _decode_velocity(const uint8_t **s, const uint8_t *end,
+                               packed_line_t *line) {
+  if (!decode_binary(s, end, &line->target_vel, 4) ||
+      !isfinite(line->target_vel) || line->target_vel < 0)
+    return STAT_INVALID_ARGUMENTS;
+
+  return STAT_OK;
+}
+
+
+// Decodes an axis target into the frame state
+static stat_t _decode_axis(const uint8_t **s, const uint8_t *end,
+                           uint16_t flags, int axis, frame_state_t *fs) {
+  uint8_t bit = 1 << axis;
+
+  if (!(flags & LINE_FIXED_bm)) {
+    float target;
+    if (!decode_binary(s, end, &target, 4)) return STAT_INVALID_ARGUMENTS;
+    if (!isfinite(target)) return STAT_BAD_FLOAT;
+    fs->position[axis] = target;
+    fs->fixed_valid &= ~bit;
+    fs->changed |= bit;
+    return STAT_OK;
+  }
+
+  int32_t position;
+  if (!decode_varint(s, end, &position)) return STAT_INVALID_ARGUMENTS;
+
+  if (flags & LINE_DELTA_bm) {
+    if (!(fs->fixed_valid & bit)) return STAT_INVALID_VALUE;
+    position += fs->fixed[axis];
+  }
+
+  fs->fixed[axis] = position;
+  fs->position[axis] = position * FIXED_POSITION_UNIT;
+  fs->fixed_valid |= bit;
+  fs->changed |= bit;
+
+  return STAT_OK;
+}
+
+
+// Decodes binary line axes and times and packs the line for queuing
+static stat_t _decode_targets(const uint8_t **s, const uint8_t *end,
+                              uint16_t flags, frame_state_t *fs,
+                              packed_line_t *line) {
+  if (!fs->limits_valid) return STAT_INVALID_ARGUMENTS;
+  line->max_accel = fs->max_accel;
+  line->max_jerk = fs->max_jerk;
+
+  // Get target position
+  float start[AXES];
+  copy_vector(start, fs->position);
+
+  for (int axis = 0; axis < AXES; axis++)
+    if (flags & (1 << axis)) {
+      stat_t status = _decode_axis(s, end, flags, axis, fs);
+      if (status) return status;
+    }
+
+  // Get times
+  float times[7] = {0,};
+  for (int i = 0; i < 7; i++)
+    if (flags & (1 << (LINE_TIMES_bp + i))) {
+      if (!decode_binary(s, end, &times[i], 4)) return STAT_INVALID_ARGUMENTS;
+      if (!isfinite(times[i])) return STAT_BAD_FLOAT;
+      if (times[i] < 0) return STAT_NEGATIVE_SCURVE_TIME;
+    }
+
+  if (!_line_pack(line, start, fs->position, times))
+    return STAT_ALL_ZERO_SCURVE_TIMES;
+
+  return STAT_OK;
+}
+
+
+/// Binary line frame, all values little-endian:
+///
+///   [id:u16][flags:u16][targetVel:f32][maxAccel:f32][maxJerk:f32]
+///   [axes...][times:f32...]
+///
+/// Flags bits 0-5 select the axes, bits 6-12 the nonzero s-curve times.  Max
+/// accel and jerk are only present if LINE_LIMITS_bm is set, otherwise the
+/// previous values are used.  They must be resent after a flush.
+///
+/// Axes are f32 unless LINE_FIXED_bm is set.  Then they are zigzag encoded
+/// signed varints in FIXED_POSITION_UNIT and, with LINE_DELTA_bm, relative to
+/// the previous fixed target.  Absent axes do not move.  Fixed positions are
+/// exact integers so deltas cannot drift, but they are forgotten whenever the
+/// position is set some other way, e.g. by a flush, a float target or 'a'.
+/// Deltas on such an axis are rejected until the host resends it absolute.
+stat_t command_binary_line(char *cmd) {
+  const uint8_t *s = (uint8_t *)cmd + 1; // Skip command code
+  const uint8_t *end = (uint8_t *)cmd + command_frame_length();
+  binary_line_t *bl = (binary_line_t *)command_reserve(COMMAND_binary_line);
+  uint16_t flags;
+  frame_state_t fs;
+
+  if (!decode_binary(&s, end, &bl->id, 2) ||
+      !decode_binary(&s, end, &flags, 2)) return STAT_INVALID_ARGUMENTS;
+
+  _frame_begin(&fs);
+  stat_t status = _decode_velocity(&s, end, &bl->line);
+  if (!status && (flags & LINE_LIMITS_bm))
+    status = _decode_limits(&s, end, &fs);
+  if (!status) status = _decode_targets(&s, end, flags, &fs, &bl->line);
+  if (status) return status;
+  if (s != end) return STAT_INVALID_ARGUMENTS;
+
+  _frame_commit(&fs);
+  command_commit(offsetof(binary_line_t, line) + _line_size(&bl->line));
+
+  return STAT_OK;
+}
+
+
+unsigned command_binary_line_size() {return sizeof(binary_line_t);}
+
+
+void command_binary_line_exec(void *data) {
+  binary_line_t *bl = (binary_line_t *)data;
+
+  command_set_id(bl->id);
+  command_line_exec(&bl->line);
+}
+
+
+// Decodes a batch's segments straight into the queue
+static stat_t _decode_batch(const uint8_t *s, const uint8_t *end, uint16_t id,
+                            uint8_t count, frame_state_t *fs) {
+  stat_t status = _decode_limits(&s, end, fs);
+  if (status) return status;
+
+  for (int i = 0; i < count; i++) {
+    if (!command_has_space(COMMAND_line_batch, 1)) return STAT_AGAIN;
+
+    binary_line_t *bl = (binary_line_t *)command_reserve(COMMAND_line_batch);
+    uint8_t delta;
+    uint16_t flags;
+
+    if (!decode_binary(&s, end, &delta, 1) ||
+        !decode_binary(&s, end, &flags, 2)) return STAT_INVALID_ARGUMENTS;
+    bl->id = id += delta;
+
+    status = _decode_velocity(&s, end, &bl->line);
+    if (!status) status = _decode_targets(&s, end, flags, fs, &bl->line);
+    if (status) return status;
+
+    command_commit(offsetof(binary_line_t, line) + _line_size(&bl->line));
+  }
+
+  return s == end ? STAT_OK : STAT_INVALID_ARGUMENTS;
+}
+
+
+/// Binary line batch frame, all values little-endian:
+///
+///   [id:u16][count:u8][maxAccel:f32][maxJerk:f32]
+///   count * ([idDelta:u8][flags:u16][targetVel:f32][axes...][times:f32...])
+///
+/// Segments are coded as in binary lines but share max accel and jerk.  Each
+/// segment's id is the previous id plus its delta, starting from the batch id.
+/// Segments are queued individually but only if the whole batch is valid.
+/// They are decoded once, into the queue, and held back from exec until the
+/// batch is complete.  If the queue fills part way, the batch is dropped
+/// and decoded again once exec has made room.  A batch is no larger than a
+/// frame, so it always fits eventually.
+stat_t command_line_batch(char *cmd) {
+  const uint8_t *s = (uint8_t *)cmd + 1; // Skip command code
+  const uint8_t *end = (uint8_t *)cmd + command_frame_length();
+  uint16_t id;
+  uint8_t count;
+
+  if (!decode_binary(&s, end, &id, 2) || !decode_binary(&s, end, &count, 1) ||
+      !count) return STAT_INVALID_ARGUMENTS;
+
+  frame_state_t fs;
+  _frame_begin(&fs);
+
+  command_begin_batch();
+  stat_t status = _decode_batch(s, end, id, count, &fs);
+  command_end_batch(!status);
+  if (status) return status;
+
+  _frame_commit(&fs);
+
+  return STAT_OK;
+}
+
+
+unsigned command_line_batch_size() {return sizeof(binary_line_t);}
+void command_line_batch_exec(void *data) {command_binary_line_exec(data);}
@@ -43,6 +43,7 @@
 #include "exec.h"
 #include "state.h"
 #include "seek.h"
+#include "encoder.h"
 #include "emu.h"
 
 #include <avr/wdt.h>
@@ -74,6 +75,7 @@ int main(int argc, char *argv[]) {
   drv8711_init();                 // motor drivers
   stepper_init();                 // steppers
   motor_init();                   // motors
+  encoder_init();                 // quadrature encoders
   exec_init();                    // motion exec
   seek_init();                    // seeking moves
   vars_init();                    // configuration variables
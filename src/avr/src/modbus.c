@@ -36,6 +36,7 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <util/crc16.h>
+#include <util/atomic.h>
 
 #include <string.h>
 #include <stdio.h>
@@ -47,6 +48,7 @@ typedef enum {
   MODBUS_CRC,
   MODBUS_INVALID,
   MODBUS_TIMEDOUT,
+  MODBUS_EXCEPTION,
 } modbus_status_t;
 
 
@@ -63,20 +65,28 @@ static struct {
   uint8_t command[MODBUS_BUF_SIZE];
   uint8_t command_length;
   uint8_t response[MODBUS_BUF_SIZE];
-  uint8_t response_length;
+  uint8_t response_length; // Expected
+  uint8_t frame_length;    // Expected for this frame, then received
+  uint16_t silence;        // Inter-frame silence in step timer counts
+  uint8_t silence_periods;
 
   uint16_t addr;
+  uint8_t count;
   modbus_rw_cb_t rw_cb;
   modbus_cb_t receive_cb;
 
   uint32_t last_write;
   uint32_t last_read;
+  uint32_t last_rx;        // Time of the last byte seen while draining
   uint8_t retry;
   uint8_t status;
+  uint8_t exception;       // Exception code of the last response, or zero
   uint16_t crc_errs;
   bool write_ready;
   bool response_ready;
   bool transmit_complete;
+  bool draining;           // Discarding the rest of a bad response
+  bool rx_activity;
   bool busy;
 } state = {0};
 
@@ -119,6 +129,51 @@ static void _set_rxc_interrupt(bool enable) {
 }
 
 
+static void _set_silence_interrupt(bool enable) {
+  // Compare B of the step timer, other compares are used by the stepper
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    TIMER_STEP.INTCTRLB = (TIMER_STEP.INTCTRLB & ~TC0_CCBINTLVL_gm) |
+      (enable ? TC_CCBINTLVL_MED_gc : TC_CCBINTLVL_OFF_gc);
+}
+
+
+static uint16_t _get_silence() {
+  // RTU frames end after 3.5 character times of silence.  Characters are
+  // 11-bits long.  Above 19200 baud a fixed 1.75ms is used.  Add one count so
+  // the delay is never a whole number of timer periods.
+  switch (cfg.baud) {
+  case USART_BAUD_9600:  return STEP_TIMER_FREQ * 38.5 / 9600 + 1;
+  case USART_BAUD_19200: return STEP_TIMER_FREQ * 38.5 / 19200 + 1;
+  default:               return STEP_TIMER_FREQ * 0.00175 + 1;
+  }
+}
+
+
+static uint8_t _get_frame_time() {
+  // Time in ms to receive a full response of 11-bit characters.  All baud
+  // rates above 19200 are at least 38400.
+  uint32_t bits = 11000UL * state.response_length;
+
+  switch (cfg.baud) {
+  case USART_BAUD_9600:  return bits / 9600 + 1;
+  case USART_BAUD_19200: return bits / 19200 + 1;
+  default:               return bits / 38400 + 1;
+  }
+}
+
+
+static void _start_silence_timer() {
+  // The compare matches once per timer period
+  uint16_t cnt = TIMER_STEP.CNT + state.silence % STEP_TIMER_POLL;
+  if (STEP_TIMER_POLL <= cnt) cnt -= STEP_TIMER_POLL;
+
+  TIMER_STEP.CCB = cnt;
+  TIMER_STEP.INTFLAGS = TC0_CCBIF_bm; // Clear stale compare
+  state.silence_periods = state.silence / STEP_TIMER_POLL;
+  _set_silence_interrupt(true);
+}
+
+
 static void _write_word(uint8_t *dst, uint16_t value, bool little_endian) {
   dst[!little_endian] = value;
   dst[little_endian]  = value >> 8;
@@ -134,19 +189,30 @@ static void _debug_transfer() {
   if (!cfg.debug) return;
 
   char out[state.command_length * 2 + 1];
-  char in[state.response_length * 2 + 1];
+  char in[state.frame_length * 2 + 1];
   format_hex_buf(out, state.command, state.command_length);
-  format_hex_buf(in, state.response, state.response_length);
+  format_hex_buf(in, state.response, state.frame_length);
 
   STATUS_DEBUG("modbus: out=0x%s in=0x%s", out, in);
 }
 
 
 static bool _check_response() {
+  // Check length, the shortest valid frame is an exception
+  if (state.frame_length < 5) {
+    if (cfg.debug) {
+      STATUS_WARNING(STAT_OK, "modbus: short response");
+      _debug_transfer();
+    }
+
+    state.status = MODBUS_INVALID;
+    return false;
+  }
+
   // Check CRC
-  uint16_t computed = _crc16(state.response, state.response_length - 2);
+  uint16_t computed = _crc16(state.response, state.frame_length - 2);
   uint16_t expected =
-    _read_word(state.response + state.response_length - 2, true);
+    _read_word(state.response + state.frame_length - 2, true);
 
   if (computed != expected) {
     if (cfg.debug) {
@@ -169,6 +235,19 @@ static bool _check_response() {
     return false;
   }
 
+  // Check for exception, 0x80 is set in the function code
+  if ((state.command[1] | 0x80) == state.response[1]) {
+    if (cfg.debug) {
+      STATUS_WARNING(STAT_OK, "modbus: exception %u for function %u",
+                     state.response[2], state.command[1]);
+      _debug_transfer();
+    }
+
+    state.status = MODBUS_EXCEPTION;
+    state.exception = state.response[2];
+    return false;
+  }
+
   // Check that function code matches
   if (state.command[1] != state.response[1]) {
     STATUS_WARNING(STAT_OK, "modbus: invalid function code, expected=%u got=%u",
@@ -178,6 +257,15 @@ static bool _check_response() {
     return false;
   }
 
+  // Check frame length
+  if (state.frame_length != state.response_length) {
+    STATUS_WARNING(STAT_OK, "modbus: invalid response length, expected=%u "
+                   "got=%u", state.response_length, state.frame_length);
+    _debug_transfer();
+    state.status = MODBUS_INVALID;
+    return false;
+  }
+
   return true;
 }
 
@@ -192,11 +280,44 @@ static void _notify(uint8_t func, uint8_t bytes, const uint8_t *data) {
 }
 
 
+static void _retry();
+static void _fail();
+
+
+static void _start_drain() {
+  // The slave may still be sending, keep listening and discard what arrives
+  state.draining = true;
+  state.rx_activity = false;
+  state.last_rx = rtc_get_time();
+  _set_write(false); // Read mode
+  _set_rxc_interrupt(true);
+}
+
+
+static void _handle_drain() {
+  if (!state.draining) return;
+
+  if (state.rx_activity) {
+    state.rx_activity = false;
+    state.last_rx = rtc_get_time();
+  }
+
+  // Resend once the line has been idle for a full frame
+  if (rtc_expired(state.last_rx + _get_frame_time())) _retry();
+}
+
+
 static void _handle_response() {
   if (!state.response_ready) return;
   state.response_ready = false;
 
-  if (!_check_response()) return;
+  if (!_check_response()) {
+    // An exception is final.  Anything else is retried once the line goes
+    // idle, or the response timeout expires, whichever comes first.
+    if (state.status == MODBUS_EXCEPTION) _fail();
+    else _start_drain();
+    return;
+  }
 
   state.last_write = 0;             // Clear timeout timer
   state.last_read = rtc_get_time(); // Set delay timer
@@ -229,19 +350,43 @@ ISR(RS485_TXC_vect) {
 }
 
 
+static void _end_frame() {
+  _set_rxc_interrupt(false);
+  _set_silence_interrupt(false);
+  _set_write(true); // Back to write mode
+  state.frame_length = state.bytes;
+  state.bytes = 0;
+  state.response_ready = true;
+}
+
+
 /// Data received interrupt
 ISR(RS485_RXC_vect) {
+  if (state.draining) {
+    uint8_t x = RS485_PORT.DATA;
+    x = x;
+    state.rx_activity = true;
+    return;
+  }
+
   state.response[state.bytes] = RS485_PORT.DATA;
 
   // Ignore leading zeros
   if (state.bytes || state.response[0]) state.bytes++;
 
-  if (state.bytes == state.response_length) {
-    _set_rxc_interrupt(false);
-    _set_write(true); // Back to write mode
-    state.bytes = 0;
-    state.response_ready = true;
-  }
+  // Exception responses are 5 bytes long
+  if (state.bytes == 2 && (state.response[1] & 0x80)) state.frame_length = 5;
+  else if (state.bytes == 1) state.frame_length = state.response_length;
+
+  if (state.bytes == state.frame_length) _end_frame();
+  else if (state.bytes) _start_silence_timer();
+}
+
+
+/// Inter-character timeout, ends frames shorter than expected
+ISR(RS485_SILENCE_vect) {
+  if (state.silence_periods) state.silence_periods--;
+  else _end_frame();
 }
 
 
@@ -253,22 +398,32 @@ static void _read_cb(uint8_t func, uint8_t bytes, const uint8_t *data) {
     return;
   }
 
-  if (state.rw_cb) state.rw_cb(false, state.addr, 0);
+  if (state.rw_cb) state.rw_cb(false, state.addr, state.exception);
   STATUS_WARNING(STAT_OK, "modbus: unexpected response to read");
   _debug_transfer();
 }
 
 
 static void _write_cb(uint8_t func, uint8_t bytes, const uint8_t *data) {
-  if ((func == MODBUS_WRITE_OUTPUT_REG ||
-       func == MODBUS_WRITE_OUTPUT_REGS) && bytes == 4 &&
-      _read_word(data, false) == state.addr) {
+  bool ok = bytes == 4 && _read_word(data, false) == state.addr;
+
+  if (ok && func == MODBUS_WRITE_OUTPUT_REG) {
     if (state.rw_cb)
       state.rw_cb(true, state.addr, _read_word(state.command + 4, false));
     return;
   }
 
-  if (state.rw_cb) state.rw_cb(false, state.addr, 0);
+  if (ok && func == MODBUS_WRITE_OUTPUT_REGS &&
+      _read_word(data + 2, false) == state.count) {
+    // Report each register written, values start after the byte count
+    if (state.rw_cb)
+      for (uint8_t i = 0; i < state.count; i++)
+        state.rw_cb(true, state.addr + i,
+                    _read_word(state.command + i * 2 + 7, false));
+    return;
+  }
+
+  if (state.rw_cb) state.rw_cb(false, state.addr, state.exception);
   STATUS_WARNING(STAT_OK, "modbus: unexpected response to write");
   _debug_transfer();
 }
@@ -278,6 +433,7 @@ static void _reset() {
   _set_dre_interrupt(false);
   _set_txc_interrupt(false);
   _set_rxc_interrupt(false);
+  _set_silence_interrupt(false);
   _set_write(true); // RS485 write mode
 
   // Flush USART
@@ -287,20 +443,46 @@ static void _reset() {
 
   // Clear state
   state.write_ready = false;
+  state.draining = false;
   state.busy = false;
 }
 
 
+static void _fail() {
+  _reset();
+  _notify(state.command[1], 0, 0);
+}
+
+
+static void _timeout() {
+  if (cfg.debug) STATUS_DEBUG("modbus: timedout");
+
+  if (state.status == MODBUS_OK || state.status == MODBUS_DISCONNECTED)
+    state.status = MODBUS_TIMEDOUT;
+
+  _fail();
+}
+
+
+static void _start_write();
+
+
 static void _retry() {
+  if (2 * MODBUS_RETRIES <= state.retry) {
+    _timeout();
+    return;
+  }
+
   state.last_write = 0;
   state.bytes = 0;
+  state.draining = false;
   state.retry++;
 
   _set_write(true); // RS485 write mode
 
   _set_txc_interrupt(false);
   _set_rxc_interrupt(false);
-  _set_dre_interrupt(true);
+  _set_silence_interrupt(false);
 
   // Try changing pin polarity
   if (state.retry == MODBUS_RETRIES) {
@@ -309,17 +491,11 @@ static void _retry() {
   }
 
   if (cfg.debug) STATUS_DEBUG("modbus: retry %d", state.retry);
-}
-
-
-static void _timeout() {
-  if (cfg.debug) STATUS_DEBUG("modbus: timedout");
 
-  if (state.status == MODBUS_OK || state.status == MODBUS_DISCONNECTED)
-    state.status = MODBUS_TIMEDOUT;
-
-  _reset();
-  _notify(state.command[1], 0, 0);
+  // Resend after the minimum delay between messages
+  state.last_read = rtc_get_time();
+  state.write_ready = true;
+  _start_write();
 }
 
 
@@ -390,9 +566,11 @@ void modbus_func(uint8_t func, uint8_t send, const uint8_t *data,
   state.bytes = 0;
   state.command_length = send + 4;
   state.response_length = receive + 4;
+  state.silence = _get_silence();
   state.receive_cb = receive_cb;
   state.last_write = 0;
   state.retry = 0;
+  state.exception = 0;
 
   ESTOP_ASSERT(state.command_length <= MODBUS_BUF_SIZE, STAT_MODBUS_BUF_LENGTH);
   ESTOP_ASSERT(state.response_length <= MODBUS_BUF_SIZE,
@@ -412,6 +590,7 @@ void modbus_func(uint8_t func, uint8_t send, const uint8_t *data,
 void modbus_read(uint16_t addr, uint16_t count, modbus_rw_cb_t cb) {
   state.rw_cb = cb;
   state.addr = addr;
+  state.count = count;
   uint8_t cmd[4];
   _write_word(cmd, addr, false);
   _write_word(cmd + 2, count, false);
@@ -422,6 +601,7 @@ void modbus_read(uint16_t addr, uint16_t count, modbus_rw_cb_t cb) {
 void modbus_write(uint16_t addr, uint16_t value, modbus_rw_cb_t cb) {
   state.rw_cb = cb;
   state.addr = addr;
+  state.count = 1;
   uint8_t cmd[4];
   _write_word(cmd, addr, false);
   _write_word(cmd + 2, value, false);
@@ -430,14 +610,26 @@ void modbus_write(uint16_t addr, uint16_t value, modbus_rw_cb_t cb) {
 
 
 void modbus_multi_write(uint16_t addr, uint16_t value, modbus_rw_cb_t cb) {
+  modbus_write_regs(addr, 1, &value, cb);
+}
+
+
+void modbus_write_regs(uint16_t addr, uint8_t count, const uint16_t *values,
+                       modbus_rw_cb_t cb) {
+  ESTOP_ASSERT(count && count <= MODBUS_MAX_REGS, STAT_MODBUS_BUF_LENGTH);
+
   state.rw_cb = cb;
   state.addr = addr;
-  uint8_t cmd[7];
+  state.count = count;
+  uint8_t cmd[5 + 2 * MODBUS_MAX_REGS];
   _write_word(cmd, addr, false);      // Start address
-  _write_word(cmd + 2, 1, false);     // Number of regs
-  cmd[4] = 2;                         // Number of bytes
-  _write_word(cmd + 5, value, false); // Value
-  modbus_func(MODBUS_WRITE_OUTPUT_REGS, 7, cmd, 4, _write_cb);
+  _write_word(cmd + 2, count, false); // Number of regs
+  cmd[4] = 2 * count;                 // Number of bytes
+
+  for (uint8_t i = 0; i < count; i++)
+    _write_word(cmd + i * 2 + 5, values[i], false);
+
+  modbus_func(MODBUS_WRITE_OUTPUT_REGS, 2 * count + 5, cmd, 4, _write_cb);
 }
 
 
@@ -448,6 +640,7 @@ void modbus_callback() {
   }
 
   _handle_response();
+  _handle_drain();
   _start_write();
 
   // Timeout out writes
@@ -466,8 +659,7 @@ void modbus_callback() {
                  sent, received, state.response_length);
   }
 
-  if (state.retry < 2 * MODBUS_RETRIES) _retry();
-  else _timeout();
+  _retry();
 }
 
 
@@ -57,6 +57,12 @@
            Send: [id][func][addr][count][bytes][regs][crc]
         Receive: [id][func][addr][count][crc]
 
+    Exception response to any function:
+
+        Receive: [id][func | 0x80][code][crc]
+
+  Frames end after 3.5 character times of silence on the line.
+
   Where:
 
              id: 1-byte   Slave ID
@@ -67,6 +73,7 @@
           value: 2-byte   Value read or written
            bits: n-bytes  Flags indicating on/off
            regs: n-bytes  register values to write
+           code: 1-byte   Exception code
        checksum: 16-bit   CRC: x^16 + x^15 + x^2 + 1 (0x8005) initial: 0xffff
 
 \******************************************************************************/
@@ -98,7 +105,16 @@ typedef enum {
 } modbus_base_addrs_t;
 
 
+typedef enum {
+  MODBUS_ILLEGAL_FUNCTION  = 1,
+  MODBUS_ILLEGAL_ADDRESS   = 2,
+  MODBUS_ILLEGAL_VALUE     = 3,
+  MODBUS_DEVICE_FAILURE    = 4,
+} modbus_exception_t;
+
+
 typedef void (*modbus_cb_t)(uint8_t func, uint8_t bytes, const uint8_t *data);
+// On failure @param value is the slave's exception code, or zero
 typedef void (*modbus_rw_cb_t)(bool ok, uint16_t addr, uint16_t value);
 
 void modbus_init();
@@ -109,4 +125,6 @@ void modbus_func(uint8_t func, uint8_t send, const uint8_t *data,
 void modbus_read(uint16_t addr, uint16_t count, modbus_rw_cb_t cb);
 void modbus_write(uint16_t addr, uint16_t value, modbus_rw_cb_t cb);
 void modbus_multi_write(uint16_t addr, uint16_t value, modbus_rw_cb_t cb);
+void modbus_write_regs(uint16_t addr, uint8_t count, const uint16_t *values,
+                       modbus_rw_cb_t cb);
 void modbus_callback();
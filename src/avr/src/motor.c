@@ -38,7 +38,10 @@
 #include "util.h"
 #include "pgmspace.h"
 #include "exec.h"
+#include "io.h"
+#include "encoder.h"
 
+#include <util/atomic.h>
 #include <util/delay.h>
 
 #include <string.h>
@@ -50,6 +53,23 @@
 #define TC_WGMODE_SINGLESLOPE_gc TC_WGMODE_SS_gc
 #endif
 
+// A single step in the longest move must fit the step timer at clk/4
+#if 0xffff <= SEGMENT_MAX_MS * (F_CPU / 4000)
+#error SEGMENT_MAX_MS is too long for the step timer
+#endif
+
+
+// A prepped move, queued in step with the stepper's move queue
+typedef struct {
+  bool prepped;
+  uint8_t clock;
+  uint16_t period;               // First timer period, zero when not moving
+  int16_t period_step;           // Timer period change per ms
+  bool negative;
+  int32_t position;
+  int16_t correction;            // Error correction steps included
+} motor_move_t;
+
 
 typedef struct {
   // Config
@@ -57,8 +77,9 @@ typedef struct {
   uint8_t step_pin;
   uint8_t dir_pin;
   TC0_t *timer;
-  DMA_CH_t *dma;
+  DMA_CH_t *dma;                 // Step counter, zero for software stepping
   uint8_t dma_trigger;
+  float min_ticks;               // Shortest step period w/ clk/1
 
   bool slave;
   uint16_t microsteps;           // microsteps per full step
@@ -70,23 +91,40 @@ typedef struct {
   float min_soft_limit;
   float max_soft_limit;
   bool homed;
+  float encoder_scale;           // Steps per encoder count, zero open loop
+  uint16_t max_error;            // Following error limit in steps, or zero
+  float backlash;                // Extra travel on reversal to negative
+  uint8_t pitch_points;          // Used pitch error table entries
+  float pitch_position[MOTOR_PITCH_POINTS]; // Increasing axis positions
+  float pitch_error[MOTOR_PITCH_POINTS];    // Measured error at each position
 
   // Computed
   float steps_per_unit;
 
   // Runtime state
   uint32_t power_timeout;
+  int32_t origin;                // Step position at the last reset
+  int32_t origin_count;          // Encoder count at the last reset
   int32_t commanded;
   int32_t encoder;
   int16_t error;
+  int16_t correction;            // Corrections not yet reflected in error
+  int16_t load_correction;       // Correction of the running move
   bool last_negative;
+  uint16_t period;               // Current timer period
+  int16_t period_step;           // Timer period change per ms
 
-  // Move prep
-  bool prepped;
+  // Move prep, of the last prepped move
   uint8_t clock;
-  uint16_t timer_period;
+  uint16_t timer_period;         // Average timer period
   bool negative;
+  float target;                  // Axis position last converted to steps
+  float compensation;            // Backlash and pitch offset of the target
+  float backlash_offset;         // Backlash taken up so far
+  uint8_t pitch_cursor;          // Pitch table entry at or below the target
+  bool travel_negative;          // Direction of the last travel
   int32_t position;
+  motor_move_t moves[STEP_QUEUE_SIZE];
 } motor_t;
 
 
@@ -98,6 +136,7 @@ static motor_t motors[MOTORS] = {
     .timer           = &TCD0,
     .dma             = &DMA.CH0,
     .dma_trigger     = DMA_CH_TRIGSRC_TCD0_CCA_gc,
+    .min_ticks       = STEP_PULSE_WIDTH * 1.9,
   }, {
     .axis            = AXIS_Y,
     .step_pin        = STEP_1_PIN,
@@ -105,6 +144,7 @@ static motor_t motors[MOTORS] = {
     .timer           = &TCE0,
     .dma             = &DMA.CH1,
     .dma_trigger     = DMA_CH_TRIGSRC_TCE0_CCA_gc,
+    .min_ticks       = STEP_PULSE_WIDTH * 1.9,
   }, {
     .axis            = AXIS_Z,
     .step_pin        = STEP_2_PIN,
@@ -112,6 +152,7 @@ static motor_t motors[MOTORS] = {
     .timer           = &TCF0,
     .dma             = &DMA.CH2,
     .dma_trigger     = DMA_CH_TRIGSRC_TCF0_CCA_gc,
+    .min_ticks       = STEP_PULSE_WIDTH * 1.9,
   }, {
     .axis            = AXIS_A,
     .step_pin        = STEP_3_PIN,
@@ -119,10 +160,26 @@ static motor_t motors[MOTORS] = {
     .timer           = (TC0_t *)&TCE1,
     .dma             = &DMA.CH3,
     .dma_trigger     = DMA_CH_TRIGSRC_TCE1_CCA_gc,
+    .min_ticks       = STEP_PULSE_WIDTH * 1.9,
+  }, {
+    // No DMA channel is left so steps are generated and counted in software.
+    // Step and direction are output on remappable IO pins.
+    .axis            = AXIS_B,
+    .timer           = (TC0_t *)&TIMER_SOFT_STEP,
+    .min_ticks       = SOFT_STEP_MIN_PERIOD,
   }
 };
 
 
+// Software step generator state
+static struct {
+  PORT_t *port;                  // Step pin port, zero when not mapped
+  uint8_t bm;
+  volatile bool pulse;
+  volatile uint16_t steps;
+} _soft = {0};
+
+
 static uint8_t _dummy;
 
 
@@ -154,6 +211,15 @@ void motor_init() {
 
     _update_config(motor);
 
+    if (!m->dma) {
+      // Setup software step timer, pulses are output from its interrupts
+      m->timer->CTRLB = TC_WGMODE_SINGLESLOPE_gc;
+      m->timer->CCA = STEP_PULSE_WIDTH;
+      m->timer->INTCTRLA = TC_OVFINTLVL_HI_gc;
+      m->timer->INTCTRLB = TC_CCAINTLVL_HI_gc;
+      continue;
+    }
+
     // Setup motor timer
     m->timer->CTRLB = TC_WGMODE_SINGLESLOPE_gc | TC1_CCAEN_bm;
     m->timer->CCA = STEP_PULSE_WIDTH;
@@ -222,10 +288,73 @@ static int32_t _position_to_steps(int motor, float position) {
 }
 
 
+// Pitch error at an axis position, interpolated from the table.  The cursor
+// follows the axis so each lookup only moves to neighboring entries.
+static float _pitch_error(motor_t &m, float position) {
+  const uint8_t n = m.pitch_points;
+  if (!n) return 0;
+
+  uint8_t c = m.pitch_cursor < n ? m.pitch_cursor : n - 1;
+  while (c && position < m.pitch_position[c]) c--;
+  while (c + 1 < n && m.pitch_position[c + 1] <= position) c++;
+  m.pitch_cursor = c;
+
+  const float p0 = m.pitch_position[c];
+  const float e0 = m.pitch_error[c];
+  if (position <= p0 || c + 1 == n) return e0;
+
+  // Entries are set one at a time so the table may be out of order
+  const float p1 = m.pitch_position[c + 1];
+  if (p1 <= p0) return e0;
+
+  return e0 + (m.pitch_error[c + 1] - e0) * (position - p0) / (p1 - p0);
+}
+
+
+static float _backlash_target(const motor_t &m) {
+  return m.travel_negative ? -m.backlash : 0;
+}
+
+
+// Converts an axis position to steps with backlash and pitch compensation.
+// On reversal the backlash is taken up by at most @param max_backlash per
+// call, so it does not add a burst of steps to a single move.
+static int32_t _target_to_steps(int motor, float target, float max_backlash) {
+  motor_t &m = motors[motor];
+
+  const float backlash = _backlash_target(m);
+  const float remaining = backlash - m.backlash_offset;
+  if (fabs(remaining) <= max_backlash) m.backlash_offset = backlash;
+  else m.backlash_offset += remaining < 0 ? -max_backlash : max_backlash;
+
+  m.compensation = m.backlash_offset - _pitch_error(m, target);
+
+  return _position_to_steps(motor, target + m.compensation);
+}
+
+
+static bool _closed_loop(int motor) {
+  const motor_t &m = motors[motor];
+  return m.encoder_scale && m.enabled && encoder_is_enabled(motor);
+}
+
+
+// Position in steps measured by the encoder
+static int32_t _get_feedback(int motor) {
+  const motor_t &m = motors[motor];
+  int32_t count = encoder_get_count(motor) - m.origin_count;
+  return m.origin + (int32_t)round(count * m.encoder_scale);
+}
+
+
 void motor_set_position(int motor, float position) {
   motor_t *m = &motors[motor];
-  m->commanded = m->encoder = m->position = _position_to_steps(motor, position);
+  m->target = position;
+  m->commanded = m->encoder = m->position =
+    _target_to_steps(motor, position, INFINITY);
   m->error = 0;
+  m->origin = m->position;
+  m->origin_count = encoder_get_count(motor);
 }
 
 
@@ -268,116 +397,294 @@ stat_t motor_rtc_callback() { // called by controller
 
 void motor_emulate_steps(int motor) {
   motor_t *m = &motors[motor];
-  m->dma->TRFCNT = 0xffff - abs(m->commanded - m->encoder);
+  uint16_t steps = abs(m->commanded - m->encoder);
+  if (m->dma) m->dma->TRFCNT = 0xffff - steps;
+  else _soft.steps = steps;
+}
+
+
+ISR(SOFT_STEP_ISR) {
+  if (_soft.port) _soft.port->OUTTGL = _soft.bm;
+  _soft.pulse = true;
+  _soft.steps++;
+}
+
+
+ISR(SOFT_STEP_PULSE_ISR) {
+  if (!_soft.pulse) return;
+  if (_soft.port) _soft.port->OUTTGL = _soft.bm;
+  _soft.pulse = false;
+}
+
+
+// End a step pulse cut short by stopping the clock
+static void _soft_end() {
+  TIMER_SOFT_STEP.INTFLAGS = TC1_CCAIF_bm;
+  if (_soft.pulse && _soft.port) _soft.port->OUTTGL = _soft.bm;
+  _soft.pulse = false;
+}
+
+
+static void _soft_load(bool dir) {
+  io_set_output(OUTPUT_DIR_4, dir);
+
+  uint8_t pin = io_get_output_pin(OUTPUT_STEP_4);
+  _soft.port = pin ? PIN_PORT(pin) : 0;
+  _soft.bm = pin ? PIN_BM(pin) : 0;
+  _soft.steps = 0;
+}
+
+
+static uint16_t _get_steps(const motor_t &m) {
+  return m.dma ? 0xffff - m.dma->TRFCNT : _soft.steps;
 }
 
 
 void motor_end_move(int motor) {
   motor_t &m = motors[motor];
 
-  if (!m.timer->CTRLA) return;
+  const bool closed_loop = _closed_loop(motor);
+
+  // The running move's correction is now part of the measured error
+  m.correction -= m.load_correction;
+  m.load_correction = 0;
+
+  if (m.timer->CTRLA) {
+    // Stop clock
+    m.timer->CTRLA = 0;
+
+    // Wait for pending DMA transfers
+    if (m.dma) while (m.dma->CTRLB & DMA_CH_CHPEND_bm) continue;
+    else _soft_end();
 
-  // Stop clock
-  m.timer->CTRLA = 0;
+    // Get actual step count
+    const int32_t steps = _get_steps(m);
 
-  // Wait for pending DMA transfers
-  while (m.dma->CTRLB & DMA_CH_CHPEND_bm) continue;
+    // Accumulate encoder
+    m.encoder += m.last_negative ? -steps : steps;
 
-  // Get actual step count from DMA channel
-  const int32_t steps = 0xffff - m.dma->TRFCNT;
+  } else if (!closed_loop) return;
 
-  // Accumulate encoder & compute error
-  m.encoder += m.last_negative ? -steps : steps;
-  m.error = m.commanded - m.encoder;
+  // Use the measured position, also while stopped to catch lost steps
+  if (closed_loop) m.encoder = _get_feedback(motor);
+
+  // Compute error
+  int32_t error = m.commanded - m.encoder;
+  if (error < -0x7fff) error = -0x7fff;
+  if (0x7fff < error) error = 0x7fff;
+  m.error = error;
+
+  if (closed_loop && m.max_error && m.max_error < labs(error))
+    estop_trigger(STAT_FOLLOWING_ERROR);
 }
 
 
-void motor_load_move(int motor) {
+// Step position including the steps taken so far in the current move.  Must
+// not be interrupted by the step timer.
+int32_t motor_get_live_position(int motor) {
+  const motor_t &m = motors[motor];
+
+  if (_closed_loop(motor)) return _get_feedback(motor);
+  if (!m.timer->CTRLA) return m.encoder;
+
+  const int32_t steps = _get_steps(m);
+  return m.encoder + (m.last_negative ? -steps : steps);
+}
+
+
+float motor_steps_to_position(int motor, int32_t steps) {
+  const motor_t &m = motors[motor];
+  if (!m.steps_per_unit) return 0;
+  return steps / m.steps_per_unit - m.compensation;
+}
+
+
+void motor_load_move(int motor, uint8_t slot) {
   motor_t &m = motors[motor];
+  motor_move_t &move = m.moves[slot];
 
   // Clear move
-  ESTOP_ASSERT(m.prepped, STAT_MOTOR_NOT_PREPPED);
-  m.prepped = false;
+  ESTOP_ASSERT(move.prepped, STAT_MOTOR_NOT_PREPPED);
+  move.prepped = false;
 
   motor_end_move(motor);
+  m.load_correction = move.correction;
 
-  if (!m.timer_period) return; // Leave clock stopped
+  if (!move.period) return; // Leave clock stopped
 
   // Set direction, compensating for polarity but only when moving
-  const bool dir = m.negative ^ m.reverse;
-  if (dir != IN_PIN(m.dir_pin)) {
-    SET_PIN(m.dir_pin, dir);
+  const bool dir = move.negative ^ m.reverse;
 
-    // We need at least 200ns between direction change and next step.
-    if (m.timer->CCA < m.timer->CNT) m.timer->CNT = m.timer->CCA + 1;
-  }
+  if (!m.dma) _soft_load(dir);
+  else {
+    if (dir != IN_PIN(m.dir_pin)) {
+      SET_PIN(m.dir_pin, dir);
 
-  // Reset DMA step counter
-  m.dma->CTRLA &= ~DMA_CH_ENABLE_bm;
-  m.dma->TRFCNT = 0xffff;
-  m.dma->CTRLA |= DMA_CH_ENABLE_bm;
+      // We need at least 200ns between direction change and next step.
+      if (m.timer->CCA < m.timer->CNT) m.timer->CNT = m.timer->CCA + 1;
+    }
+
+    // Reset DMA step counter
+    m.dma->CTRLA &= ~DMA_CH_ENABLE_bm;
+    m.dma->TRFCNT = 0xffff;
+    m.dma->CTRLA |= DMA_CH_ENABLE_bm;
+  }
 
   // To avoid causing counter wrap around, it is important to start the clock
   // before setting PERBUF.  If PERBUF is set before the clock is started PER
   // updates immediately and possibly mid step.
 
   // Set clock and period
-  m.timer->CTRLA  = m.clock;         // Start clock
-  m.timer->PERBUF = m.timer_period;  // Set next frequency
-  m.last_negative = m.negative;
-  m.commanded     = m.position;
+  m.timer->CTRLA  = move.clock;      // Start clock
+  m.timer->PERBUF = move.period;     // Set next frequency
+  m.period        = move.period;
+  m.period_step   = move.period_step;
+  m.last_negative = move.negative;
+  m.commanded     = move.position;
+}
+
+
+// Called every ms, from the step timer interrupt, between move loads
+void motor_ramp_move(int motor) {
+  motor_t &m = motors[motor];
+
+  if (!m.period_step || !m.timer->CTRLA) return;
+
+  m.period += m.period_step;
+  m.timer->PERBUF = m.period;
+}
+
+
+// Variance of a ramp's per ms offsets, (ms^2 - 1) / 12, in 1/256ths
+static const uint16_t _ramp_var[] = {0, 0, 64, 171, 320, 512, 747, 1024, 1344};
+#if 8 < SEGMENT_MAX_MS
+#error _ramp_var is too short for SEGMENT_MAX_MS
+#endif
+
+
+// Ramps the timer period through the move so the step rate changes
+// gradually from the last move's rate.  A linear period ramp around the
+// target period would step faster on average, since the rate is the
+// period's inverse.  The ramp is centered slightly above the target so the
+// average rate, and so the step count, stays close to the target.  Periods
+// change at the 1ms step timer tick.  This runs per motor in the low level
+// exec interrupt, so it uses integer math only, with one 32-bit divide for
+// the step and a second only when centering shifts the period by at least
+// half a tick.
+static void _prep_ramp(motor_move_t &move, uint16_t period,
+                       uint16_t last_period, uint8_t ms) {
+  int32_t diff = (int32_t)period - last_period;
+
+  move.period = period;
+  move.period_step = 0;
+
+  if (ms < 2 || !period || !last_period || 0x7fff <= labs(diff)) return;
+
+  // Period change per ms, i.e. the change over one move spread over its ms
+  int32_t step = diff * (period >> 1) / ((int32_t)(last_period >> 1) * ms);
+  int32_t span = step * (ms - 1) / 2;
+  if (!span) return;
+
+  // Stay within the timer's range, this also keeps the math below in range
+  const int32_t min = STEP_PULSE_WIDTH * 2;
+  if (period - labs(span) < min || 0xffff < period + labs(span)) return;
+
+  // Mean of 1 / (c + x) is about (1 + var(x) / c^2) / c
+  uint32_t var = (uint32_t)labs(step) * labs(step);
+  if (var < 1UL << 20) var = var * _ramp_var[ms] >> 8;
+  else var = (var >> 8) * _ramp_var[ms];
+  int32_t center = period;
+  if (period >> 1 <= var) center += (var + (period >> 1)) / period;
+
+  int32_t first = center - span;
+  int32_t last = center + span;
+  if (first < min || last < min || 0xffff < first || 0xffff < last) return;
+
+  move.period = first;
+  move.period_step = step;
 }
 
 
-void motor_prep_move(int motor, float target) {
+void motor_prep_move(int motor, uint8_t slot, float target, uint8_t ms) {
   // Validate input
   ESTOP_ASSERT(0 <= motor && motor < MOTORS, STAT_MOTOR_ID_INVALID);
   ESTOP_ASSERT(isfinite(target), STAT_BAD_FLOAT);
 
   motor_t &m = motors[motor];
-  ESTOP_ASSERT(!m.prepped, STAT_MOTOR_NOT_READY);
-
-  // Travel in steps
-  int32_t position = _position_to_steps(motor, target);
-  int24_t steps = position - m.position;
-  m.position = position;
+  motor_move_t &move = m.moves[slot];
+  ESTOP_ASSERT(!move.prepped, STAT_MOTOR_NOT_READY);
+
+  // Last move, for ramping
+  uint16_t last_period = m.timer_period;
+  uint8_t last_clock = m.clock;
+  bool last_negative = m.negative;
+
+  // Travel in steps, the conversion is skipped when the axis is not moving
+  // and no backlash is left to take up.  Backlash is taken up no faster
+  // than the axis' max velocity.
+  int24_t steps = 0;
+  if (target != m.target || m.backlash_offset != _backlash_target(m)) {
+    if (target != m.target) m.travel_negative = target < m.target;
+    float max_backlash = axis_get_velocity_max(m.axis) * ms / 60000;
+    int32_t position = _target_to_steps(motor, target, max_backlash);
+    steps = position - m.position;
+    m.position = position;
+    m.target = target;
+  }
 
-  // Error correction
-  int16_t correction = abs(m.error);
+  // Error correction.  The error was measured before the moves still
+  // queued ran, so do not correct again what they already correct.
+  int32_t error;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) error = (int32_t)m.error - m.correction;
+  int32_t correction = labs(error);
   if (MIN_STEP_CORRECTION <= correction) {
     // Dampen correction oscillation
     correction >>= 1;
+    if (error < 0) correction = -correction;
 
     // Make correction
-    steps += m.error < 0 ? -correction : correction;
-  }
+    steps += correction;
+
+  } else correction = 0;
+
+  move.correction = correction;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) m.correction += correction;
 
   // Positive steps from here on
   m.negative = steps < 0;
   if (m.negative) steps = -steps;
 
-  // Start with clock / 2
-  const float seg_clocks = SEGMENT_TIME * (F_CPU * 60 / 2);
-  float ticks_per_step = seg_clocks / steps;
+  m.timer_period = 0;
 
-  // Use faster clock with faster step rates for increased resolution.
-  if (ticks_per_step < 0x7fff) {
-    ticks_per_step *= 2;
-    m.clock = TC_CLKSEL_DIV1_gc;
+  if (steps) {
+    // Start with clock / 2
+    const float seg_clocks = ms * (F_CPU / 1000 / 2);
+    float ticks_per_step = seg_clocks / steps;
 
-    // Limit clock if step rate is too fast
-    // We allow a slight fudge here (i.e. 1.9 instead 2) because the motor
-    // driver is able to handle it and otherwise we could not actually hit
-    // an average rate of 250k usteps/sec.
-    if (ticks_per_step < STEP_PULSE_WIDTH * 1.9)
-      ticks_per_step = STEP_PULSE_WIDTH * 1.9; // Too fast
+    // Use faster clock with faster step rates for increased resolution.
+    if (ticks_per_step < 0x7fff) {
+      ticks_per_step *= 2;
+      m.clock = TC_CLKSEL_DIV1_gc;
 
-  } else m.clock = TC_CLKSEL_DIV2_gc; // NOTE, pulse width will be twice as long
+      // Limit clock if step rate is too fast
+      // We allow a slight fudge for the hardware step generators (i.e. 1.9
+      // instead 2) because the motor driver is able to handle it and
+      // otherwise we could not actually hit an average rate of 250k
+      // usteps/sec.
+      if (ticks_per_step < m.min_ticks) ticks_per_step = m.min_ticks;
 
-  // Disable clock if too slow
-  if (0xffff <= ticks_per_step) ticks_per_step = 0;
+    } else if (ticks_per_step < 0xffff)
+      m.clock = TC_CLKSEL_DIV2_gc; // NOTE, pulse width will be 2x long
 
-  m.timer_period = steps ? round(ticks_per_step) : 0;
+    else {
+      // Single steps in long moves, pulse width will be 4x long
+      ticks_per_step /= 2;
+      m.clock = TC_CLKSEL_DIV4_gc;
+    }
+
+    // Disable clock if too slow
+    if (ticks_per_step < 0xffff) m.timer_period = round(ticks_per_step);
+  }
 
   // Power motor
   if (!m.enabled) {
@@ -389,8 +696,15 @@ void motor_prep_move(int motor, float target) {
     m.power_timeout = rtc_get_time() + MOTOR_IDLE_TIMEOUT * 1000;
   _update_power(motor);
 
+  // Only ramp between moves in the same direction with the same clock
+  if (m.clock != last_clock || m.negative != last_negative) last_period = 0;
+  _prep_ramp(move, m.timer_period, last_period, ms);
+
   // Queue move
-  m.prepped = true;
+  move.clock = m.clock;
+  move.negative = m.negative;
+  move.position = m.position;
+  move.prepped = true;
 }
 
 
@@ -492,3 +806,58 @@ void set_homed(int motor, bool homed) {motors[motor].homed = homed;}
 
 int32_t get_encoder(int m) {return motors[m].encoder;}
 int32_t get_error(int m) {return motors[m].error;}
+float get_encoder_scale(int m) {return motors[m].encoder_scale;}
+
+
+void set_encoder_scale(int m, float scale) {
+  motors[m].encoder_scale = scale;
+  _reset_encoder(m);
+}
+
+
+uint16_t get_max_error(int m) {return motors[m].max_error;}
+void set_max_error(int m, uint16_t steps) {motors[m].max_error = steps;}
+float get_backlash(int m) {return motors[m].backlash;}
+
+
+void set_backlash(int m, float backlash) {
+  motors[m].backlash = backlash;
+  _reset_encoder(m);
+}
+
+
+uint8_t get_pitch_points(int m) {return motors[m].pitch_points;}
+
+
+void set_pitch_points(int m, uint8_t points) {
+  if (MOTOR_PITCH_POINTS < points) return;
+  motors[m].pitch_points = points;
+  _reset_encoder(m);
+}
+
+
+// Pitch table vars are indexed by motor then entry
+#define PITCH_MOTOR(i) motors[(i) / MOTOR_PITCH_POINTS]
+#define PITCH_ENTRY(i) ((i) % MOTOR_PITCH_POINTS)
+
+
+float get_pitch_position(int i) {
+  return PITCH_MOTOR(i).pitch_position[PITCH_ENTRY(i)];
+}
+
+
+void set_pitch_position(int i, float position) {
+  PITCH_MOTOR(i).pitch_position[PITCH_ENTRY(i)] = position;
+  _reset_encoder(i / MOTOR_PITCH_POINTS);
+}
+
+
+float get_pitch_error(int i) {
+  return PITCH_MOTOR(i).pitch_error[PITCH_ENTRY(i)];
+}
+
+
+void set_pitch_error(int i, float error) {
+  PITCH_MOTOR(i).pitch_error[PITCH_ENTRY(i)] = error;
+  _reset_encoder(i / MOTOR_PITCH_POINTS);
+}
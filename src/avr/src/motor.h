@@ -56,5 +56,8 @@ void motor_set_step_output(int motor, bool enabled);
 stat_t motor_rtc_callback();
 
 void motor_end_move(int motor);
-void motor_load_move(int motor);
-void motor_prep_move(int motor, float target);
+int32_t motor_get_live_position(int motor);
+float motor_steps_to_position(int motor, int32_t steps);
+void motor_load_move(int motor, uint8_t slot);
+void motor_ramp_move(int motor);
+void motor_prep_move(int motor, uint8_t slot, float target, uint8_t ms);
@@ -0,0 +1,122 @@
+/******************************************************************************\
+
+                  This file is part of the Buildbotics firmware.
+
+         Copyright (c) 2015 - 2023, Buildbotics LLC, All rights reserved.
+
+          This Source describes Open Hardware and is licensed under the
+                                  CERN-OHL-S v2.
+
+          You may redistribute and modify this Source and make products
+     using it under the terms of the CERN-OHL-S v2 (https:/cern.ch/cern-ohl).
+            This Source is distributed WITHOUT ANY EXPRESS OR IMPLIED
+     WARRANTY, INCLUDING OF MERCHANTABILITY, SATISFACTORY QUALITY AND FITNESS
+      FOR A PARTICULAR PURPOSE. Please see the CERN-OHL-S v2 for applicable
+                                   conditions.
+
+                 Source location: https://github.com/buildbotics
+
+       As per CERN-OHL-S v2 section 4, should You produce hardware based on
+     these sources, You must maintain the Source Location clearly visible on
+     the external case of the CNC Controller or other product you make using
+                                   this Source.
+
+                 For more information, email info@buildbotics.com
+
+\******************************************************************************/
+
+#include "output.h"
+
+#include "status.h"
+#include "util.h"
+#include "command.h"
+#include "io.h"
+
+#include <string.h>
+
+
+// Output ids, in the same order as the output_active var index
+#define OUTPUT_IDS "0123MF"
+
+
+typedef struct {
+  float dist;
+  uint8_t output;
+  bool active;
+} sync_output_t;
+
+
+static sync_output_t _sync = {-1};
+
+
+static void _set(uint8_t output, bool active) {
+  io_set_output(io_get_output_function(output), active);
+}
+
+
+/// Load a distance synchronized output change from the command queue and
+/// when it is due at distance @param d add it to the @param on and @param off
+/// bit masks.  Returns true if a change was added.
+bool output_load_sync(float d, uint16_t *on, uint16_t *off) {
+  if (_sync.dist < 0 && command_peek() == COMMAND_sync_output)
+    _sync = *(sync_output_t *)(command_next() + 1);
+
+  if (_sync.dist < 0 || d < _sync.dist) return false;
+  _sync.dist = -1; // Mark done
+
+  uint16_t bit = 1 << _sync.output;
+  if (_sync.active) {*on |= bit; *off &= ~bit;}
+  else {*off |= bit; *on &= ~bit;}
+
+  return true;
+}
+
+
+/// Apply any pending change when motion stops before reaching it
+void output_flush_sync() {
+  if (_sync.dist < 0) return;
+  _sync.dist = -1; // Mark done
+  _set(_sync.output, _sync.active);
+}
+
+
+// Called from hi-priority stepper interrupt
+void output_update(uint16_t on, uint16_t off) {
+  for (uint8_t i = 0; on | off; i++, on >>= 1, off >>= 1)
+    if ((on | off) & 1) _set(i, on & 1);
+}
+
+
+// Command callbacks
+stat_t command_sync_output(char *cmd) {
+  sync_output_t s;
+
+  cmd++; // Skip command code
+
+  // Get distance
+  if (!decode_float(&cmd, &s.dist) || s.dist < 0) return STAT_BAD_FLOAT;
+
+  // Output id
+  const char *id = *cmd ? strchr(OUTPUT_IDS, *cmd) : 0;
+  if (!id) return STAT_INVALID_ARGUMENTS;
+  s.output = id - OUTPUT_IDS;
+  cmd++;
+
+  // State
+  if (*cmd != '0' && *cmd != '1') return STAT_INVALID_ARGUMENTS;
+  s.active = *cmd == '1';
+
+  // Queue
+  command_push(COMMAND_sync_output, &s);
+
+  return STAT_OK;
+}
+
+
+unsigned command_sync_output_size() {return sizeof(sync_output_t);}
+
+
+void command_sync_output_exec(void *data) {
+  sync_output_t *s = (sync_output_t *)data;
+  _set(s->output, s->active);
+}
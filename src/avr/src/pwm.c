@@ -185,6 +185,12 @@ void pwm_update(const power_update_t &update) {
 }
 
 
+// Called from hi-priority raster interrupt, must be very fast
+void pwm_update_period(uint16_t period) {
+  if (pwm.initialized) _update_clock(period);
+}
+
+
 // Var callbacks
 float get_pwm_min_duty() {return pwm.min_duty * 100;}
 
@@ -30,16 +30,48 @@
 #include "usart.h"
 #include "rtc.h"
 #include "vars.h"
+#include "command.h"
+#include "pgmspace.h"
+
+#include <stdio.h>
 
 
 static bool _full = false;
 static uint32_t _last = 0;
 
+static struct {
+  uint8_t seq;
+  uint16_t space;
+  uint32_t last;
+} _credit;
+
 
 void report_request_full() {_full = true;}
 
 
+// Tells the host which frames have been consumed and how much command queue
+// space is left so it can limit the data in flight.  Reported quickly on
+// change and otherwise at the normal report rate.
+static void _report_credit() {
+  uint8_t seq = command_get_seq();
+  uint16_t space = command_get_space();
+  bool changed = seq != _credit.seq || space != _credit.space;
+
+  uint32_t now = rtc_get_time();
+  if (now - _credit.last < (changed ? CREDIT_RATE : REPORT_RATE)) return;
+
+  _credit.seq = seq;
+  _credit.space = space;
+  _credit.last = now;
+
+  printf_P(PSTR("{\"credit\":{\"seq\":%u,\"space\":%u,\"line\":%u}}\n"),
+           seq, space, command_get_line_space());
+}
+
+
 void report_callback() {
+  _report_credit();
+
   // Wait until output buffer is empty
   if (!usart_tx_empty()) return;
 
@@ -30,7 +30,10 @@
 #include "config.h"
 #include "io.h"
 #include "motor.h"
+#include "drv8711.h"
 #include "vfd_spindle.h"
+#include "spindle.h"
+#include "timing.h"
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
@@ -43,6 +46,7 @@ static uint32_t ticks;
 
 
 ISR(RTC_OVF_vect) {
+  uint32_t start = timing_now();
   ticks += 4;
 
   //static bool toggle = false;
@@ -50,8 +54,12 @@ ISR(RTC_OVF_vect) {
 
   io_rtc_callback();
   vfd_spindle_rtc_callback();
+  spindle_rtc_callback();
+  drv8711_rtc_callback();
   if (!(ticks & 255)) motor_rtc_callback(); // Every 1/4 s
   wdt_reset();
+
+  timing_record(TIMING_RTC, start);
 }
 
 
@@ -35,6 +35,10 @@
 #include "exec.h"
 #include "stepper.h"
 #include "drv8711.h"
+#include "motor.h"
+#include "config.h"
+
+#include <util/atomic.h>
 
 #include <stdint.h>
 
@@ -56,6 +60,15 @@ typedef struct {
 static seek_t seek = {false, IO_DISABLED, 0};
 
 
+// Motor positions captured by the switch pin change interrupt
+static struct {
+  uint8_t pin;
+  bool level;                    // Pin level of the sought switch state
+  volatile bool latched;
+  int32_t steps[MOTORS];
+} latch = {0};
+
+
 static bool _is_stall_input(int sw) {
   return INPUT_STALL_0 <= sw && sw <= INPUT_STALL_3;
 }
@@ -86,6 +99,51 @@ void seek_init() {
 io_function_t seek_get_input() {return seek.active ? seek.sw : IO_DISABLED;}
 
 
+static void _latch_enable(bool enable) {
+  if (!latch.pin) return;
+
+  PORT_t *port = PIN_PORT(latch.pin);
+
+  if (enable) {
+    port->INT0MASK = PIN_BM(latch.pin);
+    port->INTFLAGS = PORT_INT0IF_bm; // Clear stale edge
+    port->INTCTRL = (port->INTCTRL & ~PORT_INT0LVL_gm) | PORT_INT0LVL_HI_gc;
+
+  } else {
+    port->INTCTRL &= ~PORT_INT0LVL_gm;
+    port->INT0MASK = 0;
+  }
+}
+
+
+static void _latch_start() {
+  _latch_enable(false);
+
+  bool active_level;
+  latch.pin = io_get_input_pin(seek.sw, &active_level);
+  latch.level = active_level ^ !(seek.flags & SEEK_ACTIVE);
+  latch.latched = false;
+  _latch_enable(true);
+}
+
+
+/// Capture the live motor positions on the first edge into the sought state.
+/// Runs at the same level as the step timer so no move can load meanwhile.
+static void _latch_isr() {
+  if (latch.latched || IN_PIN(latch.pin) != latch.level) return;
+
+  for (int motor = 0; motor < MOTORS; motor++)
+    latch.steps[motor] = motor_get_live_position(motor);
+
+  latch.latched = true;
+}
+
+
+ISR(SEEK_A_ISR_vect) {_latch_isr();}
+ISR(SEEK_B_ISR_vect) {_latch_isr();}
+ISR(SEEK_F_ISR_vect) {_latch_isr();}
+
+
 bool seek_found() {
   if (!seek.active) return false;
 
@@ -105,6 +163,7 @@ bool seek_found() {
 static void _done() {
   if (!seek.active) return;
   seek.active = false;
+  _latch_enable(false);
 
   if (_is_stall_input(seek.sw))
     drv8711_set_stall_detect(_input_motor(seek.sw), false);
@@ -114,10 +173,13 @@ static void _done() {
 void seek_end() {
   if (!seek.active) return;
 
-  if (!(SEEK_FOUND & seek.flags))
-    state_seek_hold(false, SEEK_ERROR & seek.flags);
+  bool found = SEEK_FOUND & seek.flags;
+  if (!found) state_seek_hold(false, SEEK_ERROR & seek.flags);
 
   _done();
+
+  // Drop a latch caused by noise, the switch was never found
+  if (!found) latch.latched = false;
 }
 
 
@@ -166,7 +228,24 @@ unsigned command_seek_size() {return sizeof(seek_t);}
 
 void command_seek_exec(void *data) {
   seek = *(seek_t *)data;
+  _latch_start();
 
   if (_is_stall_input(seek.sw))
     drv8711_set_stall_detect(_input_motor(seek.sw), true);
 }
+
+
+// Var callbacks
+bool get_latched() {return latch.latched;}
+
+
+float get_latch_position(int axis) {
+  int32_t steps[MOTORS];
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) memcpy(steps, latch.steps, sizeof(steps));
+
+  for (int motor = 0; motor < MOTORS; motor++)
+    if (motor_get_axis(motor) == axis)
+      return motor_steps_to_position(motor, steps[motor]);
+
+  return exec_get_axis_position(axis);
+}
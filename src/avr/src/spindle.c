@@ -30,13 +30,18 @@
 #include "huanyang.h"
 #include "vfd_spindle.h"
 #include "stepper.h"
+#include "output.h"
 #include "config.h"
 #include "command.h"
 #include "exec.h"
 #include "estop.h"
 #include "util.h"
+#include "base64.h"
+#include "encoder.h"
+#include "rtc.h"
 
 #include <math.h>
+#include <string.h>
 
 
 typedef struct {
@@ -45,10 +50,34 @@ typedef struct {
 } sync_speed_t;
 
 
+// Feed synchronized to measured spindle speed
+typedef struct {
+  bool enabled;
+  uint8_t encoder; // One plus the encoder index, zero for VFD feedback
+  float cpr;       // Encoder counts per revolution
+  int32_t count;   // Encoder count at the start of the window
+  uint32_t time;   // Start of the measurement window
+  float rpm;       // Speed measured by the encoder
+  int32_t phase;   // Encoder count at the last advance
+  float lag;       // Spindle revolutions ahead of the motion
+} spindle_sync_t;
+
+
+// Laser powers at a fixed pitch along a line
+typedef struct {
+  float offset; // Distance along the line to the first pixel
+  float pitch;  // Distance between pixels
+  uint8_t count;
+  uint8_t powers[RASTER_MAX_PIXELS]; // Fraction of full power * 255
+} raster_t;
+
+
 static struct {
   spindle_type_t type;
   float override;
   sync_speed_t sync_speed;
+  spindle_sync_t sync;
+  raster_t raster;
   float speed;
   bool reversed;
   float min_rpm;
@@ -160,13 +189,37 @@ static power_update_t _get_power_update() {
 }
 
 
-void spindle_load_power_updates(power_update_t updates[], float minD,
-                                float maxD) {
-  float stepD = (maxD - minD) * (1.0 / POWER_MAX_UPDATES);
+static power_update_t _get_raster_update(float d) {
+  int pixel = floor((d - spindle.raster.offset) / spindle.raster.pitch);
+
+  if (pixel < 0 || spindle.raster.count <= pixel) return _get_power_update();
+
+  float power = spindle.raster.powers[pixel] * (1 / 255.0) * spindle.override;
+  return pwm_get_update(1 < power ? 1 : power);
+}
+
+
+/// Raster powers sampled RASTER_SUBSTEPS times over [@param d, d + stepD)
+static void _load_raster(power_update_t &update, float d, float stepD) {
+  float subD = stepD / RASTER_SUBSTEPS;
+  d += subD / 2; // Sample in the middle of each substep
+
+  update = _get_raster_update(d);
+  update.raster = true;
+
+  for (unsigned i = 0; i < RASTER_SUBSTEPS - 1; i++)
+    update.raster_periods[i] = _get_raster_update(d += subD).period;
+}
+
+
+void spindle_load_power_updates(power_update_t updates[], unsigned count,
+                                float minD, float maxD) {
+  float stepD = (maxD - minD) / count;
   float d = minD + 1e-3; // Starting distance
 
-  for (unsigned i = 0; i < POWER_MAX_UPDATES; i++) {
+  for (unsigned i = 0; i < count; i++) {
     bool changed = false;
+    uint16_t on = 0, off = 0;
     d += stepD; // Ending distance for this power step
 
     while (true) {
@@ -174,6 +227,15 @@ void spindle_load_power_updates(power_update_t updates[], float minD,
       if (spindle.sync_speed.dist < 0 && command_peek() == COMMAND_sync_speed)
         spindle.sync_speed = *(sync_speed_t *)(command_next() + 1);
 
+      // Sync outputs are queued in line with sync speeds
+      if (output_load_sync(d, &on, &off)) continue;
+
+      // Load the next raster once the current one is done
+      if (!spindle.raster.count && command_peek() == COMMAND_raster) {
+        spindle.raster = *(raster_t *)(command_next() + 1);
+        continue;
+      }
+
       // Exit if we don't have a speed or it's not ready to be set
       if (spindle.sync_speed.dist == -1 || d < spindle.sync_speed.dist) break;
 
@@ -183,11 +245,21 @@ void spindle_load_power_updates(power_update_t updates[], float minD,
       changed = true;
     }
 
-    if (spindle.type == SPINDLE_TYPE_PWM) updates[i] = _get_power_update();
-    else {
+    if (spindle.type == SPINDLE_TYPE_PWM) {
+      if (spindle.raster.count) _load_raster(updates[i], d - stepD, stepD);
+      else updates[i] = _get_power_update();
+
+    } else {
       updates[i].state = POWER_IGNORE;
       if (changed) spindle_update_speed();
     }
+
+    updates[i].outputs_on = on;
+    updates[i].outputs_off = off;
+
+    // Raster done
+    if (spindle.raster.offset + spindle.raster.count * spindle.raster.pitch <
+        d) spindle.raster.count = 0;
   }
 }
 
@@ -199,6 +271,8 @@ void spindle_update_speed() {_set_speed(spindle.speed);}
 
 // Called from lo-priority stepper interrupt
 void spindle_idle() {
+  spindle.raster.count = 0;
+
   if (spindle.sync_speed.dist != -1) {
     spindle.sync_speed.dist = -1; // Mark done
     spindle.speed = spindle.sync_speed.speed;
@@ -209,10 +283,15 @@ void spindle_idle() {
 }
 
 
-void spindle_stop() {_set_speed(0);} // Only called when steppers have halted
+// Only called when steppers have halted
+void spindle_stop() {
+  spindle.sync.enabled = false;
+  _set_speed(0);
+}
 
 
 void spindle_estop() {
+  spindle.sync.enabled = false;
   _set_speed(0);
   if (spindle.type == SPINDLE_TYPE_PWM) pwm_update(pwm_get_update(0));
 }
@@ -255,6 +334,95 @@ void set_min_spin(float value) {
 }
 
 
+static bool _sync_encoder_enabled() {
+  return spindle.sync.encoder && spindle.sync.cpr &&
+    encoder_is_enabled(spindle.sync.encoder - 1);
+}
+
+
+bool spindle_is_synced() {return spindle.sync.enabled;}
+
+
+/// Measured spindle speed as a signed fraction of max speed
+static float _sync_measured() {
+  if (_sync_encoder_enabled()) return spindle.sync.rpm * spindle.inv_max_rpm;
+
+  // Most VFDs report speed unsigned, assume the commanded direction
+  float power = fabs(_get_power());
+  return _speed_to_power(spindle.speed) < 0 ? -power : power;
+}
+
+
+/// Ratio of measured to commanded spindle speed while the feed is synchronized
+/// to the spindle, otherwise one.  Line execution advances by this much plan
+/// time per unit of real time so the feed per revolution is kept.  Any phase
+/// lag is made up over SPINDLE_SYNC_CORRECTION.  A stopped spindle slows
+/// motion to a crawl, a zero ratio would stall line exec.  Line exec further
+/// limits the scale to its axes' limits.
+float spindle_get_sync_scale() {
+  if (!spindle.sync.enabled) return 1;
+
+  float commanded = _speed_to_power(spindle.speed);
+  if (!commanded) return SPINDLE_SYNC_MIN; // Wait for the spindle
+
+  // Phase lag in revs to a speed correction as a fraction of max speed
+  const float rate = 60000.0 / SPINDLE_SYNC_CORRECTION; // per min
+  float correction = spindle.sync.lag * rate * spindle.inv_max_rpm;
+  float scale = (_sync_measured() + correction) / commanded;
+
+  if (scale < SPINDLE_SYNC_MIN) return SPINDLE_SYNC_MIN;
+  return scale < SPINDLE_SYNC_MAX ? scale : SPINDLE_SYNC_MAX;
+}
+
+
+/// Accumulates spindle phase against motion.  Called with the plan and real
+/// time of each line segment, in minutes.
+void spindle_sync_advance(float plan_time, float real_time) {
+  if (!spindle.sync.enabled) return;
+
+  float commanded = _speed_to_power(spindle.speed);
+  if (!commanded) {spindle.sync.lag = 0; return;}
+
+  // Spindle revolutions during the segment
+  float revs;
+  if (_sync_encoder_enabled()) {
+    int32_t count = encoder_get_count(spindle.sync.encoder - 1);
+    revs = (count - spindle.sync.phase) / spindle.sync.cpr;
+    spindle.sync.phase = count;
+
+  } else revs = _sync_measured() * spindle.max_rpm * real_time;
+
+  spindle.sync.lag += revs - commanded * spindle.max_rpm * plan_time;
+
+  // Lag in the commanded direction
+  float ahead = commanded < 0 ? -spindle.sync.lag : spindle.sync.lag;
+
+  // Motion cannot keep up with the spindle, stop rather than cut a bad thread
+  if (SPINDLE_SYNC_MAX_LAG < ahead) estop_trigger(STAT_SPINDLE_SYNC);
+
+  // Motion ahead of a slow spindle waits for at most the max lag
+  if (ahead < -SPINDLE_SYNC_MAX_LAG)
+    spindle.sync.lag = commanded < 0 ? SPINDLE_SYNC_MAX_LAG :
+      -SPINDLE_SYNC_MAX_LAG;
+}
+
+
+/// Measures spindle speed from the encoder
+void spindle_rtc_callback() {
+  if (!_sync_encoder_enabled()) return;
+
+  uint32_t now = rtc_get_time();
+  uint32_t ms = now - spindle.sync.time;
+  if (ms < SPINDLE_SYNC_WINDOW) return;
+
+  int32_t count = encoder_get_count(spindle.sync.encoder - 1);
+  int32_t delta = count - spindle.sync.count;
+  spindle.sync.rpm = delta / spindle.sync.cpr * (60000.0 / ms);
+  spindle.sync.count = count;
+  spindle.sync.time = now;
+}
+
+
 uint16_t get_spindle_status() {
   switch (spindle.type) {
   case SPINDLE_TYPE_DISABLED: return 0;
@@ -265,6 +433,31 @@ uint16_t get_spindle_status() {
 }
 
 
+bool get_spindle_sync() {return spindle.sync.enabled;}
+
+
+void set_spindle_sync(bool enable) {
+  if (enable && !spindle.sync.enabled) {
+    spindle.sync.lag = 0;
+    if (_sync_encoder_enabled())
+      spindle.sync.phase = encoder_get_count(spindle.sync.encoder - 1);
+  }
+
+  spindle.sync.enabled = enable;
+}
+
+
+
+uint8_t get_spindle_encoder() {return spindle.sync.encoder;}
+
+
+void set_spindle_encoder(uint8_t encoder) {
+  if (encoder <= ENCODERS) spindle.sync.encoder = encoder;
+}
+
+
+float get_spindle_enc_cpr() {return spindle.sync.cpr;}
+void set_spindle_enc_cpr(float cpr) {spindle.sync.cpr = 0 < cpr ? cpr : 0;}
 float get_speed_override() {return spindle.override;}
 
 
@@ -323,6 +516,39 @@ void command_sync_speed_exec(void *data) {
 }
 
 
+stat_t command_raster(char *cmd) {
+  raster_t r;
+
+  cmd++; // Skip command code
+
+  // Get offset and pitch
+  if (!decode_float(&cmd, &r.offset) || r.offset < 0) return STAT_BAD_FLOAT;
+  if (!decode_float(&cmd, &r.pitch) || r.pitch <= 0)  return STAT_BAD_FLOAT;
+
+  // Powers, unpadded base64
+  unsigned len = strlen(cmd);
+  if (!len || len % 4 == 1 || RASTER_MAX_PIXELS < len * 3 / 4)
+    return STAT_INVALID_ARGUMENTS;
+  if (!b64_decode(cmd, len, r.powers)) return STAT_INVALID_ARGUMENTS;
+  r.count = len * 3 / 4;
+
+  // Queue
+  command_push(COMMAND_raster, &r);
+
+  return STAT_OK;
+}
+
+
+unsigned command_raster_size() {return sizeof(raster_t);}
+
+
+// Rasters are read from the queue by spindle_load_power_updates() while
+// their line runs.  Like every synchronous command, a raster still queued
+// when no line takes it, e.g. after its line was cut short, ends up here.
+// It is dropped so it cannot apply to a later line.
+void command_raster_exec(void *data) {}
+
+
 stat_t command_speed(char *cmd) {
   cmd++; // Skip command code
 
@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include "config.h"
+
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -42,6 +44,10 @@ typedef struct {
   power_state_t state;
   float power;
   uint16_t period; // Used by PWM
+  uint16_t outputs_on;  // Distance synced output changes, see output.c
+  uint16_t outputs_off;
+  bool raster;          // Sub ms PWM periods follow, see spindle.c
+  uint16_t raster_periods[RASTER_SUBSTEPS - 1];
 } power_update_t;
 
 
@@ -74,8 +80,12 @@ typedef void (*deinit_cb_t)();
 spindle_type_t spindle_get_type();
 void spindle_stop();
 void spindle_estop();
-void spindle_load_power_updates(power_update_t updates[], float minD,
-                                float maxD);
+void spindle_load_power_updates(power_update_t updates[], unsigned count,
+                                float minD, float maxD);
 void spindle_update(const power_update_t &update);
 void spindle_update_speed();
 void spindle_idle();
+bool spindle_is_synced();
+float spindle_get_sync_scale();
+void spindle_sync_advance(float plan_time, float real_time);
+void spindle_rtc_callback();
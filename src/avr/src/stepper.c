@@ -35,6 +35,11 @@
 #include "cpp_magic.h"
 #include "exec.h"
 #include "drv8711.h"
+#include "timing.h"
+#include "output.h"
+#include "pwm.h"
+#include "seek.h"
+#include "state.h"
 
 #include <util/atomic.h>
 
@@ -42,21 +47,38 @@
 #include <stdio.h>
 
 
+// A prepped move or dwell
+typedef struct {
+  float dwell;   // Dwell time in seconds, zero for moves
+  uint8_t ticks; // Length in ms
+  float target[AXES];
+  power_update_t powers[POWER_MAX_UPDATES];
+} st_move_t;
+
+
+#define STEP_QUEUE_MASK (STEP_QUEUE_SIZE - 1)
+#if STEP_QUEUE_SIZE & STEP_QUEUE_MASK
+#error STEP_QUEUE_SIZE is not a power of 2
+#endif
+
+
 typedef struct {
   // Runtime
   bool busy;
   bool requesting;
+  bool running;  // Move at head of queue is running
   float dwell;
-  uint8_t power_buf;
+  uint8_t ticks; // Length of the current move in ms
+  uint8_t tick;  // ms into the current move
   uint8_t power_index;
+  const uint16_t *raster_periods; // Sub ms PWM periods for the current ms
+  uint8_t raster_index;
 
-  // Move prep
-  bool move_ready;  // Prepped move ready for loader
+  // Move queue, the loader pops from head and prep pushes at tail
+  st_move_t moves[STEP_QUEUE_SIZE];
+  volatile uint8_t head;
+  volatile uint8_t tail;
   bool move_queued; // Prepped move queued
-  float prep_dwell;
-  int8_t power_next;
-
-  power_update_t powers[2][POWER_MAX_UPDATES];
 
   uint32_t underrun;
 } stepper_t;
@@ -80,14 +102,43 @@ static void _end_move() {
 }
 
 
+static void _set_raster_interrupt(bool enable) {
+  // Leave the other compare interrupts alone, see RS485_SILENCE_vect
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    TIMER_STEP.INTCTRLB = (TIMER_STEP.INTCTRLB & ~TC0_CCAINTLVL_gm) |
+      (enable ? TC_CCAINTLVL_HI_gc : TC_CCAINTLVL_OFF_gc);
+}
+
+
+static uint8_t _queue_fill() {return (st.tail - st.head) & STEP_QUEUE_MASK;}
+static bool _queue_full() {return _queue_fill() == STEP_QUEUE_MASK;}
+static st_move_t *_queue_tail() {return &st.moves[st.tail];}
+
+
+/// Seeks and stops must react to where the motors are, so exec stays only
+/// one move ahead of the running move.  Otherwise it fills the queue.
+static bool _queue_ready() {
+  if (seek_get_input() != IO_DISABLED || state_get() == STATE_STOPPING)
+    return 1 < _queue_fill();
+  return _queue_full();
+}
+
+
 static void _load_move() {
   for (int motor = 0; motor < MOTORS; motor++)
-    motor_load_move(motor);
+    motor_load_move(motor, st.head);
+}
+
+
+static void _ramp_move() {
+  for (int motor = 0; motor < MOTORS; motor++)
+    motor_ramp_move(motor);
 }
 
 
 void st_shutdown() {
   TIMER_STEP.CTRLA = 0;         // Stop stepper clock
+  _set_raster_interrupt(false); // Stop raster updates
   _end_move();                  // Stop motor clocks
   ADCB_CH0_INTCTRL = 0;         // Disable next move interrupt
 }
@@ -97,10 +148,37 @@ void st_shutdown() {
 bool st_is_busy() {return st.busy;}
 
 
+/// Record the time left until the loader runs out of prepped moves.
+static void _record_slack() {
+  uint32_t counts = 0;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (!st.running || st.dwell) return;
+
+    // Rest of the current move, the step ISR fires at the end of each ms
+    counts = (uint32_t)(st.ticks - st.tick - 1) * STEP_TIMER_POLL +
+      STEP_TIMER_POLL - TIMER_STEP.CNT;
+
+    // Moves queued behind it
+    for (uint8_t i = (st.head + 1) & STEP_QUEUE_MASK; i != st.tail;
+         i = (i + 1) & STEP_QUEUE_MASK) {
+      if (st.moves[i].dwell) return; // Dwells have slack to spare
+      counts += (uint32_t)st.moves[i].ticks * STEP_TIMER_POLL;
+    }
+  }
+
+  timing_slack(counts);
+}
+
+
 /// Interrupt handler for calling move exec function.
 /// ADC channel 0 triggered by load ISR as a "software" interrupt.
+/// Preps moves until the queue is ready or exec has nothing more to do.
 ISR(STEP_LOW_LEVEL_ISR) {
-  while (true) {
+  uint32_t start = timing_now();
+  bool prepped = false;
+
+  while (!_queue_ready()) {
     stat_t status = exec_next();
 
     switch (status) {
@@ -110,16 +188,23 @@ ISR(STEP_LOW_LEVEL_ISR) {
         exec_set_velocity(0); // Velocity is zero if there are no moves
 
         spindle_idle();
+        output_flush_sync();
       }
       break;
 
     case STAT_AGAIN: continue;              // No command executed, try again
 
-    case STAT_OK:                           // Move executed
+    case STAT_OK: {                         // Move executed
       ESTOP_ASSERT(st.move_queued, STAT_EXPECTED_MOVE);
       st.move_queued = false;
-      st.move_ready = true;
+      prepped = true;
+
+      // Don't prep past a dwell, it may power up motors during the dwell
+      bool dwell = _queue_tail()->dwell;
+      st.tail = (st.tail + 1) & STEP_QUEUE_MASK;
+      if (!dwell) continue;
       break;
+    }
 
     default: ESTOP_ASSERT(false, status); break;
     }
@@ -127,8 +212,12 @@ ISR(STEP_LOW_LEVEL_ISR) {
     break;
   }
 
+  if (ISR_TIMING && prepped) _record_slack();
+
   ADCB_CH0_INTCTRL = 0;
   st.requesting = false;
+
+  timing_record(TIMING_EXEC, start);
 }
 
 
@@ -142,17 +231,41 @@ static void _request_exec_move() {
 }
 
 
+/// Raster substep interrupt, steps through the sub ms PWM periods.
+ISR(STEP_RASTER_ISR) {
+  pwm_update_period(st.raster_periods[st.raster_index++]);
+
+  if (st.raster_index < RASTER_SUBSTEPS - 1)
+    TIMER_STEP.CCA += STEP_TIMER_POLL / RASTER_SUBSTEPS;
+  else _set_raster_interrupt(false);
+}
+
+
+static void _start_raster(const power_update_t &update) {
+  _set_raster_interrupt(false);
+  if (!update.raster) return;
+
+  st.raster_periods = update.raster_periods;
+  st.raster_index = 0;
+  TIMER_STEP.CCA = STEP_TIMER_POLL / RASTER_SUBSTEPS;
+  TIMER_STEP.INTFLAGS = TC0_CCAIF_bm; // Clear stale compare
+  _set_raster_interrupt(true);
+}
+
+
 static void _update_power() {
-  if (st.power_index < POWER_MAX_UPDATES)
-    spindle_update(st.powers[st.power_buf][st.power_index++]);
+  if (st.running && st.power_index < POWER_MAX_UPDATES) {
+    const power_update_t &update = st.moves[st.head].powers[st.power_index++];
+    spindle_update(update);
+    output_update(update.outputs_on, update.outputs_off);
+    _start_raster(update);
+
+  } else _set_raster_interrupt(false);
 }
 
 
-/// Step timer interrupt routine.
 /// Dwell or dequeue and load next move.
-ISR(STEP_TIMER_ISR) {
-  static uint8_t tick = 0;
-
+static void _step_tick() {
   // Update spindle power on every tick
   _update_power();
 
@@ -163,24 +276,38 @@ ISR(STEP_TIMER_ISR) {
   }
   st.dwell = 0;
 
-  if (tick++ & 3) return; // Proceed every 4 ticks
+  // Proceed when the current move is done
+  if (++st.tick < st.ticks) {
+    _ramp_move();
+    return;
+  }
+  st.tick = 0;
+
+  // Done with the current move
+  if (st.running) {
+    st.running = false;
+    st.head = (st.head + 1) & STEP_QUEUE_MASK;
+  }
 
   // If the next move is not ready try to load it
-  if (!st.move_ready) {
+  if (!_queue_fill()) {
     _request_exec_move();
     _end_move();
-    tick = 0; // Try again in 1ms
+    st.ticks = 1; // Try again in 1ms
     st.busy = false;
     return;
   }
 
-  if (st.prep_dwell) {
+  st_move_t *move = &st.moves[st.head];
+  st.ticks = move->ticks;
+  st.running = true;
+
+  if (move->dwell) {
     // End last move, if any
     _end_move();
 
     // Start dwell
-    st.dwell = st.prep_dwell;
-    st.prep_dwell = 0;
+    st.dwell = move->dwell;
 
   } else {
     // Start move
@@ -191,34 +318,42 @@ ISR(STEP_TIMER_ISR) {
     _request_exec_move();
   }
 
-  // Handle power updates
-  if (st.power_next != -1) {
-    st.power_index = 0;
-    st.power_buf = st.power_next;
-    st.power_next = -1;
-    _update_power();
-  }
+  // Start power updates
+  st.power_index = 0;
+  _update_power();
+
+  st.busy = true; // Executing move so mark busy
+}
+
 
-  st.busy = true;        // Executing move so mark busy
-  st.move_ready = false; // We are done with this move, flip the flag back
+/// Step timer interrupt routine.
+ISR(STEP_TIMER_ISR) {
+  timing_tick();
+  uint32_t start = timing_now();
+  _step_tick();
+  timing_record(TIMING_STEP, start);
 }
 
 
 void st_prep_power(const power_update_t powers[]) {
-  ESTOP_ASSERT(!st.move_ready, STAT_STEPPER_NOT_READY);
-  st.power_next = !st.power_buf;
-  memcpy(st.powers[st.power_next], powers,
+  ESTOP_ASSERT(!_queue_full(), STAT_STEPPER_NOT_READY);
+  memcpy(_queue_tail()->powers, powers,
          sizeof(power_update_t) * POWER_MAX_UPDATES);
 }
 
 
-void st_prep_line(const float target[]) {
+void st_prep_line(const float target[], uint8_t ms) {
   // Trap conditions that would prevent queuing the line
-  ESTOP_ASSERT(!st.move_ready, STAT_STEPPER_NOT_READY);
+  ESTOP_ASSERT(!_queue_full(), STAT_STEPPER_NOT_READY);
 
   // Prepare motor moves
   for (int motor = 0; motor < MOTORS; motor++)
-    motor_prep_move(motor, target[motor_get_axis(motor)]);
+    motor_prep_move(motor, st.tail, target[motor_get_axis(motor)], ms);
+
+  st_move_t *move = _queue_tail();
+  move->dwell = 0;
+  move->ticks = ms;
+  memcpy(move->target, target, sizeof(move->target));
 
   st.move_queued = true; // signal prep buffer ready (do this last)
 }
@@ -226,15 +361,31 @@ void st_prep_line(const float target[]) {
 
 /// Add a dwell to the move buffer
 void st_prep_dwell(float seconds) {
-  ESTOP_ASSERT(!st.move_ready, STAT_STEPPER_NOT_READY);
+  ESTOP_ASSERT(!_queue_full(), STAT_STEPPER_NOT_READY);
   if (seconds <= 1e-4) seconds = 1e-4; // Min dwell
-  st.power_next = !st.power_buf;
-  spindle_load_power_updates(st.powers[st.power_next], 0, 0);
-  st.prep_dwell = seconds;
+  st_move_t *move = _queue_tail();
+  spindle_load_power_updates(move->powers, POWER_MAX_UPDATES, 0, 0);
+  move->dwell = seconds;
+  move->ticks = 1; // Load the next move right after the dwell
+  exec_get_position(move->target);
   st.move_queued = true; // signal prep buffer ready
 }
 
 
+/// Axis position at the end of the running move.  Exec runs ahead of it.
+float st_get_axis_position(int axis) {
+  bool running;
+  float position = 0;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    running = st.running;
+    if (running) position = st.moves[st.head].target[axis];
+  }
+
+  return running ? position : exec_get_axis_position(axis);
+}
+
+
 // Var callbacks
 uint32_t get_underrun() {return st.underrun;}
 
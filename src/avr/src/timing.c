@@ -0,0 +1,135 @@
+/******************************************************************************\
+
+                  This file is part of the Buildbotics firmware.
+
+         Copyright (c) 2015 - 2023, Buildbotics LLC, All rights reserved.
+
+          This Source describes Open Hardware and is licensed under the
+                                  CERN-OHL-S v2.
+
+          You may redistribute and modify this Source and make products
+     using it under the terms of the CERN-OHL-S v2 (https:/cern.ch/cern-ohl).
+            This Source is distributed WITHOUT ANY EXPRESS OR IMPLIED
+     WARRANTY, INCLUDING OF MERCHANTABILITY, SATISFACTORY QUALITY AND FITNESS
+      FOR A PARTICULAR PURPOSE. Please see the CERN-OHL-S v2 for applicable
+                                   conditions.
+
+                 Source location: https://github.com/buildbotics
+
+       As per CERN-OHL-S v2 section 4, should You produce hardware based on
+     these sources, You must maintain the Source Location clearly visible on
+     the external case of the CNC Controller or other product you make using
+                                   this Source.
+
+                 For more information, email info@buildbotics.com
+
+\******************************************************************************/
+
+
+#include "timing.h"
+
+#include "config.h"
+
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#include <stdint.h>
+
+
+// There is no free timer so the step timer, which free runs with a 1ms period,
+// is the time base.  Its count gives sub-microsecond resolution and the ms
+// count, kept by the step ISR, extends the range.  Timestamps pack the ms
+// count in the high word and the timer count in the low word.
+#define TIMING_AVG_SHIFT 4 // Average over ~16 samples
+
+
+static struct {
+  volatile uint16_t ms;
+  uint16_t max[TIMED_ISRS];   // Timer counts
+  uint32_t avg[TIMED_ISRS];   // Timer counts << TIMING_AVG_SHIFT
+  uint32_t slack;               // Timer counts
+} _timing = {0, {0}, {0}, 0xffffffff};
+
+
+static uint16_t _to_us(uint32_t counts) {
+  counts /= STEP_TIMER_FREQ / 1000000;
+  return 0xffff < counts ? 0xffff : counts;
+}
+
+
+#if ISR_TIMING
+/// Called from the top of STEP_TIMER_ISR
+void timing_tick() {_timing.ms++;}
+
+
+uint32_t timing_now() {
+  uint16_t ms, count;
+  bool overflow;
+
+  do {
+    ms = _timing.ms;
+    count = TIMER_STEP.CNT;
+    overflow = TIMER_STEP.INTFLAGS & TC0_OVFIF_bm;
+  } while (ms != _timing.ms);
+
+  // Account for a wrap the step ISR has not serviced yet.  This happens when
+  // called from another HI level ISR.
+  if (overflow && count < STEP_TIMER_POLL / 2) ms++;
+
+  return (uint32_t)ms << 16 | count;
+}
+
+
+/// Record the execution time of an ISR which started at @param start.
+/// Includes time spent in any higher level ISRs which interrupted it.
+void timing_record(timing_isr_t isr, uint32_t start) {
+  uint32_t end = timing_now();
+  uint16_t ms = (end >> 16) - (start >> 16);
+  int32_t counts =
+    (int32_t)ms * STEP_TIMER_POLL + (uint16_t)end - (uint16_t)start;
+  if (counts < 0) counts = 0;
+  if (0xffff < counts) counts = 0xffff;
+
+  if (_timing.max[isr] < counts) _timing.max[isr] = counts;
+  _timing.avg[isr] += counts - (_timing.avg[isr] >> TIMING_AVG_SHIFT);
+}
+
+
+/// Record the time, in timer counts, left before the step loader runs out of
+/// prepped moves.
+void timing_slack(uint32_t counts) {
+  if (counts < _timing.slack) _timing.slack = counts;
+}
+#endif // ISR_TIMING
+
+
+// Var callbacks
+uint16_t get_isr_time_max(int i) {
+  uint16_t counts;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) counts = _timing.max[i];
+  return _to_us(counts);
+}
+
+
+void set_isr_time_max(int i, uint16_t x) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) _timing.max[i] = 0;
+}
+
+
+uint16_t get_isr_time_avg(int i) {
+  uint32_t counts;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) counts = _timing.avg[i];
+  return _to_us(counts >> TIMING_AVG_SHIFT);
+}
+
+
+uint16_t get_exec_slack() {
+  uint32_t counts;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) counts = _timing.slack;
+  return _to_us(counts);
+}
+
+
+void set_exec_slack(uint16_t x) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) _timing.slack = 0xffffffff;
+}
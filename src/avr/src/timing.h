@@ -0,0 +1,55 @@
+/******************************************************************************\
+
+                  This file is part of the Buildbotics firmware.
+
+         Copyright (c) 2015 - 2023, Buildbotics LLC, All rights reserved.
+
+          This Source describes Open Hardware and is licensed under the
+                                  CERN-OHL-S v2.
+
+          You may redistribute and modify this Source and make products
+     using it under the terms of the CERN-OHL-S v2 (https:/cern.ch/cern-ohl).
+            This Source is distributed WITHOUT ANY EXPRESS OR IMPLIED
+     WARRANTY, INCLUDING OF MERCHANTABILITY, SATISFACTORY QUALITY AND FITNESS
+      FOR A PARTICULAR PURPOSE. Please see the CERN-OHL-S v2 for applicable
+                                   conditions.
+
+                 Source location: https://github.com/buildbotics
+
+       As per CERN-OHL-S v2 section 4, should You produce hardware based on
+     these sources, You must maintain the Source Location clearly visible on
+     the external case of the CNC Controller or other product you make using
+                                   this Source.
+
+                 For more information, email info@buildbotics.com
+
+\******************************************************************************/
+
+#pragma once
+
+#include "config.h"
+
+#include <stdint.h>
+
+
+typedef enum {
+  TIMING_STEP,  // STEP_TIMER_ISR
+  TIMING_EXEC,  // STEP_LOW_LEVEL_ISR
+  TIMING_RX,    // SERIAL_RXC_vect
+  TIMING_RTC,   // RTC_OVF_vect
+  TIMING_I2C,   // I2C_ISR
+} timing_isr_t;
+
+
+#if ISR_TIMING
+void timing_tick();
+uint32_t timing_now();
+void timing_record(timing_isr_t isr, uint32_t start);
+void timing_slack(uint32_t counts);
+
+#else // Compiled out, the statistics read as zero
+inline void timing_tick() {}
+inline uint32_t timing_now() {return 0;}
+inline void timing_record(timing_isr_t isr, uint32_t start) {}
+inline void timing_slack(uint32_t counts) {}
+#endif
@@ -28,6 +28,8 @@
 #include "usart.h"
 #include "cpp_magic.h"
 #include "config.h"
+#include "timing.h"
+#include "rtc.h"
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
@@ -51,6 +53,7 @@
 #include "ringbuf.def"
 
 static bool _flush = false;
+static bool _resync = false; // Discarding input after a bad frame
 
 
 static void _set_dre_interrupt(bool enable) {
@@ -82,12 +85,27 @@ ISR(SERIAL_DRE_vect) {
 
 
 // Data received interrupt vector
+// Nothing can interrupt this HI level ISR so the ring buffer indices are
+// accessed directly.  Both bytes of the receive FIFO are drained per call.
 ISR(SERIAL_RXC_vect) {
-  if (rx_buf_full()) _set_rxc_interrupt(false); // Disable interrupt
-  else rx_buf_push(SERIAL_PORT.DATA);
+  uint32_t start = timing_now();
 
-  if (rx_buf_space() < SERIAL_CTS_THRESH)
-    OUTSET_PIN(SERIAL_CTS_PIN); // CTS Hi (disable)
+  do {
+    uint16_t space = rx_buf_isr_space();
+
+    if (!space) {
+      _set_rxc_interrupt(false); // Disable interrupt
+      break;
+    }
+
+    rx_buf_isr_push(SERIAL_PORT.DATA);
+
+    if (space <= SERIAL_CTS_THRESH)
+      OUTSET_PIN(SERIAL_CTS_PIN); // CTS Hi (disable)
+
+  } while (SERIAL_PORT.STATUS & USART_RXCIF_bm);
+
+  timing_record(TIMING_RX, start);
 }
 
 
@@ -237,16 +255,45 @@ int8_t usart_getc() {
  *   ENTER     Submit current command line.
  *   BS        Backspace, delete last character.
  *   CTRL-X    Cancel current line entry.
+ *   STX       Start a binary frame: [STX][length][seq][payload][CRC-8].
+ *             The length counts the seq and payload bytes.  The frame is
+ *             returned raw, including the STX and length bytes.  A bad
+ *             length ends the frame early so the caller rejects it.
+ *
+ * A frame stalled for more than SERIAL_FRAME_TIMEOUT is dropped.  After a
+ * rejected or dropped frame, input is discarded up to the next STX or line
+ * end, see usart_rx_resync().
  */
 char *usart_readline() {
   static char line[INPUT_BUFFER_LEN];
   static int i = 0;
+  static int frame = 0; // Binary frame bytes remaining
+  static uint32_t last = 0; // Time of last frame byte
   bool eol = false;
 
   while (!rx_buf_empty()) {
     char data = usart_getc();
+    last = rtc_get_time();
+
+    if (_resync) {
+      if (data == '\r' || data == '\n') _resync = false;
+      else if (data == USART_FRAME_START) {
+        _resync = false;
+        line[i++] = data;
+      }
 
-    switch (data) {
+    } else if (frame) {
+      line[i++] = data;
+      eol = !--frame;
+
+    } else if (i == 1 && line[0] == USART_FRAME_START) {
+      uint8_t length = data;
+      line[i++] = data;
+
+      if (length < 2 || INPUT_BUFFER_LEN - 4 < length) eol = true;
+      else frame = length + 1; // Seq, payload and CRC
+
+    } else switch (data) {
     case '\r': case '\n': eol = true; break;
     case '\b': if (i) i--; break; // BS - backspace
     case 0x18: i = 0; break;      // CAN - Cancel or CTRL-X
@@ -264,10 +311,20 @@ char *usart_readline() {
     }
   }
 
+  // Drop stalled frames
+  if (i && line[0] == USART_FRAME_START &&
+      rtc_expired(last + SERIAL_FRAME_TIMEOUT)) {
+    frame = i = 0;
+    _resync = true;
+  }
+
   return 0;
 }
 
 
+void usart_rx_resync() {_resync = true;}
+
+
 void usart_flush() {
   _flush = true;
 
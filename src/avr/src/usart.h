@@ -37,6 +37,9 @@
 #define USART_TX_RING_BUF_SIZE 1024
 #define USART_RX_RING_BUF_SIZE 1024
 
+// Start of a binary frame, see usart_readline()
+#define USART_FRAME_START 0x02 // STX
+
 
 typedef enum {
   USART_BAUD_9600,
@@ -86,6 +89,7 @@ void usart_putc(char c);
 void usart_puts(const char *s);
 int8_t usart_getc();
 char *usart_readline();
+void usart_rx_resync();
 void usart_flush();
 
 void usart_rx_flush();
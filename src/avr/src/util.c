@@ -95,6 +95,47 @@ stat_t decode_axes(char **cmd, float axes[AXES]) {
 }
 
 
+bool decode_binary(const uint8_t **s, const uint8_t *end, void *x,
+                   unsigned size) {
+  if (end < *s + size) return false;
+  memcpy(x, *s, size);
+  *s += size;
+  return true;
+}
+
+
+/// Zigzag encoded signed LEB128
+bool decode_varint(const uint8_t **s, const uint8_t *end, int32_t *x) {
+  uint32_t u = 0;
+
+  for (int shift = 0; shift < 35 && *s < end; shift += 7) {
+    uint8_t b = *(*s)++;
+    u |= (uint32_t)(b & 0x7f) << shift;
+
+    if (!(b & 0x80)) {
+      *x = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+/// CRC-8, polynomial x^8 + x^2 + x + 1 (0x07), initial value zero
+uint8_t crc8(const uint8_t *data, unsigned length) {
+  uint8_t crc = 0;
+
+  while (length--) {
+    crc ^= *data++;
+    for (int i = 0; i < 8; i++)
+      crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+
+  return crc;
+}
+
+
 // Assumes the caller provide format buffer length is @param len * 2 + 1.
 void format_hex_buf(char *buf, const uint8_t *data, unsigned len) {
   uint8_t i;
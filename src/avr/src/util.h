@@ -69,6 +69,10 @@ int8_t decode_hex_nibble(char c);
 bool decode_hex_u16(char **s, uint16_t *x);
 bool decode_float(char **s, float *f);
 stat_t decode_axes(char **cmd, float axes[AXES]);
+bool decode_binary(const uint8_t **s, const uint8_t *end, void *x,
+                   unsigned size);
+bool decode_varint(const uint8_t **s, const uint8_t *end, int32_t *x);
+uint8_t crc8(const uint8_t *data, unsigned length);
 void format_hex_buf(char *buf, const uint8_t *data, unsigned len);
 
 // Constants
@@ -27,6 +27,7 @@
 
 #include "vfd_spindle.h"
 #include "modbus.h"
+#include "spindle.h"
 #include "rtc.h"
 #include "config.h"
 #include "pgmspace.h"
@@ -38,32 +39,6 @@
 #include <stdint.h>
 
 
-typedef enum {
-  REG_DISABLED,
-
-  REG_CONNECT_WRITE,
-
-  REG_MAX_FREQ_READ,
-  REG_MAX_FREQ_FIXED,
-
-  REG_FREQ_SET,
-  REG_FREQ_SIGN_SET,
-  REG_FREQ_SCALED_SET,
-
-  REG_STOP_WRITE,
-  REG_FWD_WRITE,
-  REG_REV_WRITE,
-
-  REG_FREQ_READ,
-  REG_FREQ_SIGN_READ,
-  REG_FREQ_ACTECH_READ,
-
-  REG_STATUS_READ,
-
-  REG_DISCONNECT_WRITE,
-} vfd_reg_type_t;
-
-
 typedef struct {
   vfd_reg_type_t type;
   uint16_t addr;
@@ -255,17 +230,24 @@ const vfd_reg_t fuling_dzb200_regs[] PROGMEM = {
 
 static vfd_reg_t regs[VFDREG];
 static vfd_reg_t custom_regs[VFDREG];
+static uint8_t custom_group_span;
 
 static struct {
   vfd_reg_type_t state;
   int8_t reg;
+  uint8_t group[MODBUS_MAX_REGS]; // Registers in the current transaction
+  uint8_t group_size;
+  uint8_t words;                  // Registers returned by the transaction
   uint8_t read_count;
   bool changed;
   bool shutdown;
 
   float power;
   uint16_t max_freq;
+  bool max_freq_valid;            // Survives reconnects
+  bool freq_valid;                // Actual frequency has been read
   bool user_multi_write;
+  uint8_t group_span;             // Max registers per transaction
   float actual_power;
   uint16_t status;
 
@@ -281,45 +263,79 @@ static void _disconnected() {
 }
 
 
-static bool _next_state() {
-  switch (vfd.state) {
-  case REG_MAX_FREQ_FIXED:
-    if (!vfd.power) vfd.state = REG_STOP_WRITE;
-    else vfd.state = REG_FREQ_SET;
-    break;
+/// Returns the state which follows @param state or REG_DISABLED if the
+/// transition depends on more than the commanded power.
+static vfd_reg_type_t _following_state(vfd_reg_type_t state) {
+  switch (state) {
+  case REG_CONNECT_WRITE:
+    return vfd.max_freq_valid ? REG_MAX_FREQ_FIXED : REG_MAX_FREQ_READ;
+
+  case REG_MAX_FREQ_FIXED: return vfd.power ? REG_FREQ_SET : REG_STOP_WRITE;
 
   case REG_FREQ_SCALED_SET:
-    if (vfd.power < 0) vfd.state = REG_REV_WRITE;
-    else if (0 < vfd.power) vfd.state = REG_FWD_WRITE;
-    else vfd.state = REG_STOP_WRITE;
-    break;
+    if (vfd.power < 0) return REG_REV_WRITE;
+    if (0 < vfd.power) return REG_FWD_WRITE;
+    return REG_STOP_WRITE;
 
   case REG_STOP_WRITE: case REG_FWD_WRITE: case REG_REV_WRITE:
-    vfd.state = REG_FREQ_READ;
-    break;
+    return REG_FREQ_READ;
 
+  case REG_STATUS_READ: case REG_DISCONNECT_WRITE: return REG_DISABLED;
+
+  default: return (vfd_reg_type_t)(state + 1);
+  }
+}
+
+
+static bool _is_poll(vfd_reg_type_t state) {
+  return REG_FREQ_READ <= state && state <= REG_STATUS_READ;
+}
+
+
+/// Commanded writes take priority over telemetry polls
+static bool _preempt_poll() {
+  if (vfd.shutdown) vfd.state = REG_DISCONNECT_WRITE;
+
+  else if (vfd.changed) {
+    // Update frequency and state, max frequency is only read once
+    vfd.changed = false;
+    vfd.state = vfd.max_freq_valid ? REG_MAX_FREQ_FIXED : REG_MAX_FREQ_READ;
+
+  } else return false;
+
+  vfd.reg = -1;
+  vfd.wait = 0;
+  return true;
+}
+
+
+/// Poll quickly while the spindle is ramping and slowly once at speed.
+/// Synchronized feeds follow the measured speed so always poll quickly.
+static uint16_t _get_poll_delay() {
+  if (!vfd.freq_valid) return VFD_QUERY_SLOW; // No feedback from this VFD
+  if (spindle_is_synced()) return VFD_QUERY_FAST;
+
+  // Actual power may come back unsigned, compare magnitudes
+  float error = fabs(fabs(vfd.power) - fabs(vfd.actual_power));
+  return error <= VFD_AT_SPEED ? VFD_QUERY_SLOW : VFD_QUERY_FAST;
+}
+
+
+static bool _next_state() {
+  switch (vfd.state) {
   case REG_STATUS_READ:
-    if (vfd.shutdown) vfd.state = REG_DISCONNECT_WRITE;
-
-    else if (vfd.changed) {
-      // Update frequency and state
-      vfd.changed = false;
-      vfd.state = REG_MAX_FREQ_READ;
-
-    } else {
-      // Continue querying after delay
-      vfd.state = REG_FREQ_READ;
-      vfd.wait = rtc_get_time() + VFD_QUERY_DELAY;
-      return false;
-    }
-    break;
+    if (_preempt_poll()) break;
+
+    // Continue querying after delay
+    vfd.state = REG_FREQ_READ;
+    vfd.wait = rtc_get_time() + _get_poll_delay();
+    return false;
 
   case REG_DISCONNECT_WRITE:
     _disconnected();
     return false;
 
-  default:
-    vfd.state = (vfd_reg_type_t)(vfd.state + 1);
+  default: vfd.state = _following_state(vfd.state); break;
   }
 
   return true;
@@ -353,34 +369,62 @@ static void _connect() {
 static void _modbus_cb(bool ok, uint16_t addr, uint16_t value) {
   // Handle error
   if (!ok) {
-    if (regs[vfd.reg].fails < 255) regs[vfd.reg].fails++;
+    for (uint8_t i = 0; i < vfd.group_size; i++)
+      if (regs[vfd.group[i]].fails < 255) regs[vfd.group[i]].fails++;
+
+    // The VFD may not support multi-register transactions.  Other failures,
+    // such as timeouts, do not say anything about that.
+    if (1 < vfd.group_size && (value == MODBUS_ILLEGAL_FUNCTION ||
+                               value == MODBUS_ILLEGAL_ADDRESS))
+      vfd.group_span = 1;
+
     if (vfd.shutdown) _disconnected();
     else _connect();
     return;
   }
 
-  // Handle read result
+  // Handle read result, called once for each register in the transaction
   vfd.read_count++;
 
-  switch (regs[vfd.reg].type) {
-  case REG_MAX_FREQ_READ: vfd.max_freq = value; break;
-  case REG_FREQ_READ: vfd.actual_power = value / (float)vfd.max_freq; break;
+  for (uint8_t i = 0; i < vfd.group_size; i++) {
+    const vfd_reg_t &reg = regs[vfd.group[i]];
 
-  case REG_FREQ_SIGN_READ:
-    vfd.actual_power = (int16_t)value / (float)vfd.max_freq;
-    break;
+    if (reg.type == REG_FREQ_ACTECH_READ) {
+      if (vfd.read_count == 2) {
+        vfd.actual_power = value / (float)vfd.max_freq;
+        vfd.freq_valid = true;
+      }
+      continue;
+    }
 
-  case REG_FREQ_ACTECH_READ:
-    if (vfd.read_count == 2) vfd.actual_power = value / (float)vfd.max_freq;
-    if (vfd.read_count < 6) return;
-    break;
+    if (reg.addr != addr) continue;
 
-  case REG_STATUS_READ: vfd.status = value; break;
+    switch (reg.type) {
+    case REG_MAX_FREQ_READ:
+      vfd.max_freq = value;
+      vfd.max_freq_valid = value;
+      break;
 
-  default: break;
+    case REG_FREQ_READ:
+      vfd.actual_power = value / (float)vfd.max_freq;
+      vfd.freq_valid = true;
+      break;
+
+    case REG_FREQ_SIGN_READ:
+      vfd.actual_power = (int16_t)value / (float)vfd.max_freq;
+      vfd.freq_valid = true;
+      break;
+
+    case REG_STATUS_READ: vfd.status = value; break;
+
+    default: break;
+    }
   }
 
-  // Next
+  if (vfd.read_count < vfd.words) return;
+
+  // Next, a pending change interrupts the poll cycle
+  if (_is_poll(vfd.state)) _preempt_poll();
   _next_reg();
 }
 
@@ -394,62 +438,149 @@ static bool _use_multi_write() {
 }
 
 
-static bool _exec_command() {
-  if (vfd.wait) return true;
-
-  vfd_reg_t reg = regs[vfd.reg];
-  uint16_t words = 1;
-  bool read = false;
-  bool write = false;
-
-  switch (reg.type) {
-  case REG_DISABLED: break;
+typedef enum {
+  OP_NONE,
+  OP_READ,
+  OP_WRITE,
+} vfd_op_t;
 
-  case REG_MAX_FREQ_FIXED: vfd.max_freq = reg.value; break;
 
+static vfd_op_t _get_op(vfd_reg_type_t type) {
+  switch (type) {
   case REG_FREQ_SET:
-    write = true;
-    reg.value = fabs(vfd.power) * vfd.max_freq;
-    break;
-
   case REG_FREQ_SIGN_SET:
-    write = true;
-    reg.value = vfd.power * vfd.max_freq;
-    break;
-
   case REG_FREQ_SCALED_SET:
-    write = true;
-    reg.value = fabs(vfd.power) * reg.value;
-    break;
-
   case REG_CONNECT_WRITE:
   case REG_STOP_WRITE:
   case REG_FWD_WRITE:
   case REG_REV_WRITE:
   case REG_DISCONNECT_WRITE:
-    write = true;
-    break;
+    return OP_WRITE;
 
   case REG_FREQ_ACTECH_READ:
-    words = 6;
-
   case REG_FREQ_READ:
   case REG_FREQ_SIGN_READ:
   case REG_MAX_FREQ_READ:
   case REG_STATUS_READ:
-    read = true;
-    break;
+    return OP_READ;
+
+  default: return OP_NONE;
+  }
+}
+
+
+static uint16_t _get_write_value(const vfd_reg_t &reg) {
+  switch (reg.type) {
+  case REG_FREQ_SET:        return fabs(vfd.power) * vfd.max_freq;
+  case REG_FREQ_SIGN_SET:   return vfd.power * vfd.max_freq;
+  case REG_FREQ_SCALED_SET: return fabs(vfd.power) * reg.value;
+  default:                  return reg.value;
+  }
+}
+
+
+/// Extend the current transaction with the registers which follow it in
+/// execution order.  Reads are grouped while they fit in one read of at most
+/// ``group_span`` registers.  Writes are grouped while they cover a contiguous
+/// block of distinct addresses.  Grouping stops at the first register which
+/// needs a different kind of transaction or at a state change which depends on
+/// a response from the VFD.
+static void _group_regs(vfd_op_t op, uint16_t &lo, uint16_t &hi) {
+  vfd_reg_type_t state = vfd.state;
+  int8_t reg = vfd.reg;
+
+  while (vfd.group_size < vfd.group_span) {
+    if (++reg == VFDREG) {
+      state = _following_state(state);
+      if (state == REG_DISABLED) break;
+      reg = -1;
+      continue;
+    }
+
+    if (regs[reg].type != state) continue;
+    if (_get_op(state) != op || state == REG_FREQ_ACTECH_READ) break;
+
+    uint16_t addr = regs[reg].addr;
+    uint16_t new_lo = addr < lo ? addr : lo;
+    uint16_t new_hi = hi < addr ? addr : hi;
+    if (vfd.group_span <= new_hi - new_lo) break;
+
+    // Writes must cover each address exactly once
+    if (op == OP_WRITE && new_hi - new_lo != vfd.group_size) break;
+
+    lo = new_lo;
+    hi = new_hi;
+    vfd.group[vfd.group_size++] = reg;
+    vfd.state = state;
+    vfd.reg = reg;
+  }
+}
+
+
+static bool _exec_command() {
+  if (vfd.wait) return true;
+
+  const vfd_reg_t &reg = regs[vfd.reg];
+  if (reg.type == REG_MAX_FREQ_FIXED) vfd.max_freq = reg.value;
+
+  vfd_op_t op = _get_op(reg.type);
+  if (op == OP_NONE) return false;
+
+  uint16_t lo = reg.addr;
+  uint16_t hi = reg.addr;
+  vfd.group[0] = vfd.reg;
+  vfd.group_size = 1;
+  vfd.read_count = 0;
+
+  if (reg.type != REG_FREQ_ACTECH_READ) _group_regs(op, lo, hi);
+
+  if (op == OP_READ) {
+    vfd.words = reg.type == REG_FREQ_ACTECH_READ ? 6 : hi - lo + 1;
+    modbus_read(lo, vfd.words, _modbus_cb);
+    return true;
   }
 
-  if (read) modbus_read(reg.addr, words, _modbus_cb);
-  else if (write) (_use_multi_write() ? modbus_multi_write : modbus_write)
-                    (reg.addr, reg.value, _modbus_cb);
-  else return false;
+  vfd.words = vfd.group_size;
+
+  if (vfd.group_size == 1)
+    (_use_multi_write() ? modbus_multi_write : modbus_write)
+      (reg.addr, _get_write_value(reg), _modbus_cb);
+
+  else {
+    uint16_t values[MODBUS_MAX_REGS];
+
+    for (uint8_t i = 0; i < vfd.group_size; i++) {
+      const vfd_reg_t &r = regs[vfd.group[i]];
+      values[r.addr - lo] = _get_write_value(r);
+    }
+
+    modbus_write_regs(lo, vfd.group_size, values, _modbus_cb);
+  }
 
   return true;
 }
 
 
+static uint8_t _get_group_span() {
+  switch (spindle_get_type()) {
+  case SPINDLE_TYPE_CUSTOM:     return custom_group_span;
+  case SPINDLE_TYPE_NOWFOREVER: return 2; // Control and frequency
+  case SPINDLE_TYPE_DELTA:      return 4; // Status through output freq
+  case SPINDLE_TYPE_TECO_E510:  return 5; // Status through output freq
+  case SPINDLE_TYPE_EM60:       return 2; // Control and scaled frequency
+  default:                      return 1;
+  }
+}
+
+
+static void _update_group_span() {
+  uint8_t span = _get_group_span();
+  if (!span) span = 1;
+  if (MODBUS_MAX_REGS < span) span = MODBUS_MAX_REGS;
+  vfd.group_span = span;
+}
+
+
 static void _load(const vfd_reg_t *_regs) {
   memset(&regs, 0, sizeof(regs));
 
@@ -487,6 +618,7 @@ void vfd_spindle_init() {
   default: break;
   }
 
+  _update_group_span();
   _connect();
 }
 
@@ -511,17 +643,39 @@ uint16_t vfd_get_status() {return vfd.status;}
 
 
 void vfd_spindle_rtc_callback() {
-  if (!vfd.wait || !rtc_expired(vfd.wait)) return;
-  vfd.wait = 0;
+  if (!vfd.wait) return;
+
+  // Wake early to apply a change
+  if (!_preempt_poll()) {
+    if (!rtc_expired(vfd.wait)) return;
+    vfd.wait = 0;
+  }
+
   _next_reg();
 }
 
 
 // Variable callbacks
 uint16_t get_vfd_max_freq() {return vfd.max_freq;}
-void set_vfd_max_freq(uint16_t max_freq) {vfd.max_freq = max_freq;}
+
+
+void set_vfd_max_freq(uint16_t max_freq) {
+  vfd.max_freq = max_freq;
+  vfd.max_freq_valid = max_freq;
+}
+
+
 bool get_vfd_multi_write() {return vfd.user_multi_write;}
 void set_vfd_multi_write(bool value) {vfd.user_multi_write = value;}
+uint8_t get_vfd_group_span() {return custom_group_span;}
+
+
+void set_vfd_group_span(uint8_t value) {
+  custom_group_span = value;
+  _update_group_span();
+}
+
+
 uint8_t get_vfd_reg_type(int reg) {return regs[reg].type;}
 
 
@@ -529,6 +683,7 @@ void set_vfd_reg_type(int reg, uint8_t type) {
   custom_regs[reg].type = (vfd_reg_type_t)type;
   if (spindle_get_type() == SPINDLE_TYPE_CUSTOM)
     regs[reg].type = custom_regs[reg].type;
+  vfd.max_freq_valid = false;
   vfd.changed = true;
 }
 
@@ -540,6 +695,7 @@ void set_vfd_reg_addr(int reg, uint16_t addr) {
   custom_regs[reg].addr = addr;
   if (spindle_get_type() == SPINDLE_TYPE_CUSTOM)
     regs[reg].addr = custom_regs[reg].addr;
+  vfd.max_freq_valid = false;
   vfd.changed = true;
 }
 
@@ -0,0 +1,208 @@
+/******************************************************************************\
+
+                  This file is part of the Buildbotics firmware.
+
+         Copyright (c) 2015 - 2023, Buildbotics LLC, All rights reserved.
+
+          This Source describes Open Hardware and is licensed under the
+                                  CERN-OHL-S v2.
+
+          You may redistribute and modify this Source and make products
+     using it under the terms of the CERN-OHL-S v2 (https:/cern.ch/cern-ohl).
+            This Source is distributed WITHOUT ANY EXPRESS OR IMPLIED
+     WARRANTY, INCLUDING OF MERCHANTABILITY, SATISFACTORY QUALITY AND FITNESS
+      FOR A PARTICULAR PURPOSE. Please see the CERN-OHL-S v2 for applicable
+                                   conditions.
+
+                 Source location: https://github.com/buildbotics
+
+       As per CERN-OHL-S v2 section 4, should You produce hardware based on
+     these sources, You must maintain the Source Location clearly visible on
+     the external case of the CNC Controller or other product you make using
+                                   this Source.
+
+                 For more information, email info@buildbotics.com
+
+\******************************************************************************/
+
+// Checks the float SCurve evaluator against a double precision reference of
+// the original formulas over a sweep of motion profiles.
+
+#include "SCurve.h"
+
+#include <math.h>
+#include <stdio.h>
+
+
+static const double SEGMENT_TIME = 4 / 60000.0; // mins
+
+static unsigned checks = 0;
+static unsigned failures = 0;
+
+
+static void check(const char *name, double value, double expected,
+                  double tolerance) {
+  checks++;
+  if (fabs(value - expected) <= tolerance) return;
+
+  if (failures++ < 20)
+    fprintf(stderr, "scurve-test: %s=%g expected %g, error %g > %g\n", name,
+            value, expected, fabs(value - expected), tolerance);
+}
+
+
+// Reference, uses the separate distance, velocity and acceleration formulas
+static double ref_distance(double t, double v, double a, double j) {
+  return v * t + 0.5 * a * t * t + j * t * t * t / 6;
+}
+
+
+static double ref_velocity(double t, double a, double j) {
+  return a * t + 0.5 * j * t * t;
+}
+
+
+static double ref_stopping_dist(double v, double a, double maxA,
+                                double maxJ) {
+  if (!v) return 0;
+  if (v < 0) {v = -v; a = -a;}
+
+  double d = 0;
+
+  if (0 < a) {
+    double t = a / maxJ;
+    d += ref_distance(t, v, a, -maxJ);
+    v += ref_velocity(t, a, -maxJ);
+    a = 0;
+  }
+
+  double maxDeccel = -sqrt(v * maxJ + 0.5 * a * a);
+  if (maxDeccel < -maxA) maxDeccel = -maxA;
+
+  if (maxDeccel < a) {
+    double t = (a - maxDeccel) / maxJ;
+    d += ref_distance(t, v, a, -maxJ);
+    v += ref_velocity(t, a, -maxJ);
+    a = maxDeccel;
+  }
+
+  double deltaV = 0.5 * a * a / maxJ;
+
+  if (deltaV < v) {
+    double t = (v - deltaV) / -a;
+    d += ref_distance(t, v, a, 0);
+    v += ref_velocity(t, a, 0);
+  }
+
+  return d + ref_distance(-a / maxJ, v, a, maxJ);
+}
+
+
+static double ref_next_accel(double t, double targetV, double v, double a,
+                             double maxA, double maxJ) {
+  bool increasing = v < targetV;
+  double deltaA = maxJ * t;
+
+  if (increasing && a < -deltaA) return a + deltaA;
+  if (!increasing && deltaA < a) return a - deltaA;
+
+  double targetA = sqrt(2 * fabs(targetV - v) * maxJ);
+  if (maxA < targetA) targetA = maxA;
+
+  if (increasing) return targetA < a + deltaA ? targetA : a + deltaA;
+  return a - deltaA < -targetA ? -targetA : a - deltaA;
+}
+
+
+// Runs one segment of the reference profile, returns the distance moved
+static double ref_next(double t, double targetV, double &v, double &a,
+                       double &j, double maxA, double maxJ) {
+  double nextA = ref_next_accel(t, targetV, v, a, maxA, maxJ);
+  double deltaV = nextA * t;
+
+  if ((deltaV < 0 && targetV < v && v + deltaV < targetV) ||
+      (0 < deltaV && v < targetV && targetV < v + deltaV))
+    nextA = (targetV - v) / t;
+
+  j = (nextA - a) / t;
+  double d = ref_distance(t, v, a, j);
+  v += ref_velocity(t, a, j);
+  a = nextA;
+
+  return d;
+}
+
+
+// Compares the float evaluator with the reference at one profile state
+static void check_state(double t, double targetV, double v, double a,
+                        double j, double maxA, double maxJ) {
+  // Start both from the same float inputs so only the evaluation differs
+  t = (float)t;
+  v = (float)v;
+  a = (float)a;
+  j = (float)j;
+
+  float d, dv, da;
+  SCurve::evaluate(t, v, a, j, d, dv, da);
+
+  double scale = fabs(v) + fabs(a) * t + fabs(j) * t * t;
+  check("distance", d, ref_distance(t, v, a, j), 1e-5 * scale * t + 1e-9);
+  check("velocity", dv, ref_velocity(t, a, j), 1e-5 * scale + 1e-9);
+  check("acceleration", da, j * t, 1e-5 * fabs(j) * t + 1e-9);
+
+  double stopDist = ref_stopping_dist(v, a, maxA, maxJ);
+  check("stopping distance", SCurve::stoppingDist(v, a, maxA, maxJ),
+        stopDist, 1e-4 * fabs(stopDist) + 1e-6);
+
+  check("next accel", SCurve::nextAccel(t, targetV, v, a, maxA, maxJ),
+        ref_next_accel(t, targetV, v, a, maxA, maxJ), 1e-4 * maxA);
+}
+
+
+// Ramps to maxV, cruises, then stops, checking every segment on the way
+static void check_profile(double maxV, double maxA, double maxJ) {
+  const double t = SEGMENT_TIME;
+  const double targets[] = {maxV, maxV, 0};
+  const unsigned limits[] = {100000, 100, 100000};
+
+  double v = 0, a = 0, j = 0, dist = 0;
+  float distF = 0;
+  SCurve curve(maxV, maxA, maxJ);
+
+  for (unsigned i = 0; i < 3; i++)
+    for (unsigned n = 0; n < limits[i]; n++) {
+      double targetV = targets[i];
+      if (i != 1 && v == targetV && !a) break;
+
+      check_state(t, targetV, v, a, j, maxA, maxJ);
+
+      dist += ref_next(t, targetV, v, a, j, maxA, maxJ);
+
+      float lastV = curve.getVelocity();
+      float lastA = curve.getAcceleration();
+      curve.next(t, targetV);
+
+      float d, dv, da;
+      SCurve::evaluate(t, lastV, lastA, curve.getJerk(), d, dv, da);
+      distF += d;
+    }
+
+  check("profile end velocity", curve.getVelocity(), v, 1e-4 * maxV);
+  check("profile distance", distF, dist, 1e-3 * dist);
+}
+
+
+int main(int argc, char *argv[]) {
+  const double maxVs[] = {100, 1000, 5000, 20000};    // mm/min
+  const double maxAs[] = {1e4, 1e5, 1e6, 1e7};        // mm/min^2
+  const double maxJs[] = {1e7, 1e8, 1e9, 1e10, 1e11}; // mm/min^3
+
+  for (unsigned i = 0; i < sizeof(maxVs) / sizeof(double); i++)
+    for (unsigned k = 0; k < sizeof(maxAs) / sizeof(double); k++)
+      for (unsigned l = 0; l < sizeof(maxJs) / sizeof(double); l++)
+        check_profile(maxVs[i], maxAs[k], maxJs[l]);
+
+  printf("scurve-test: %u checks, %u failures\n", checks, failures);
+
+  return !!failures;
+}
@@ -44,7 +44,7 @@ module.exports = new Vue({
       template: require('../resources/config-template.json'),
       config: {
         settings: {units: 'METRIC'},
-        motors:   [{}, {}, {}, {}],
+        motors:   [{}, {}, {}, {}, {}],
         tool:     {},
         version:  '<loading>'
       },
@@ -34,15 +34,17 @@ module.exports = {
   CRC:          2,
   INVALID:      3,
   TIMEDOUT:     4,
+  EXCEPTION:    5,
 
 
   status_to_string(status) {
     switch (status) {
-    case this.OK:       return 'Ok'
-    case this.CRC:      return 'CRC error'
-    case this.INVALID:  return 'Invalid response'
-    case this.TIMEDOUT: return 'Timedout'
-    default:            return 'Disconnected'
+    case this.OK:        return 'Ok'
+    case this.CRC:       return 'CRC error'
+    case this.INVALID:   return 'Invalid response'
+    case this.TIMEDOUT:  return 'Timedout'
+    case this.EXCEPTION: return 'Exception'
+    default:             return 'Disconnected'
     }
   }
 }
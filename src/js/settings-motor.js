@@ -53,11 +53,18 @@ module.exports = {
     },
 
 
-    maxStepsPerSecond() {return (0.5 / this.motor['step-length'])},
+    maxStepsPerSecond() {
+      let rate = 0.5 / this.motor['step-length']
+
+      // Motor 4 is stepped in software, see SOFT_STEP_MAX_RATE on the AVR
+      if (this.index == 4) rate = Math.min(rate, 10000)
+
+      return rate
+    },
 
 
     maxMaxVelocity() {
-      let maxUStepsPerSecond = 0.5 / this.motor['step-length']
+      let maxUStepsPerSecond = this.maxStepsPerSecond
       let uStepsPerRevolution =
           (360.0 / this.motor['step-angle']) * this.motor.microsteps
       let maxRPS = maxUStepsPerSecond / uStepsPerRevolution
@@ -171,6 +178,9 @@ module.exports = {
       if (name == 'power' && this.motor['type-of-driver'] == 'generic external')
         return false
 
+      // Only the first four motors have encoder inputs
+      if (name == 'encoder' && 4 <= this.index) return false
+
       return true
     }
   }
@@ -85,7 +85,8 @@ module.exports = {
 
     show_modbus_field(key) {
       return key != 'regs' &&
-        (key != 'multi-write' || this.tool_type == 'CUSTOM MODBUS VFD')
+        ((key != 'multi-write' && key != 'group-span') ||
+         this.tool_type == 'CUSTOM MODBUS VFD')
     },
 
 
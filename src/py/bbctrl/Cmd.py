@@ -36,7 +36,11 @@ MODBUS_WRITE = 'M'
 SEEK         = 's'
 SET_AXIS     = 'a'
 LINE         = 'l'
+BINARY_LINE  = 'L'
+LINE_BATCH   = 'B'
 SYNC_SPEED   = '%'
+SYNC_OUTPUT  = 'O'
+RASTER       = 'W'
 SPEED        = 'p'
 INPUT        = 'I'
 DWELL        = 'd'
@@ -57,6 +61,21 @@ HELP         = 'h'
 SEEK_ACTIVE = 1 << 0
 SEEK_ERROR  = 1 << 1
 
+# Keep this in sync with AVR code usart.h and line.c
+FRAME_START    = 0x02
+FRAME_MAX      = 250 # Payload bytes
+LINE_TIMES_BP  = 6
+LINE_LIMITS_BM = 1 << 13
+LINE_FIXED_BM  = 1 << 14
+LINE_DELTA_BM  = 1 << 15
+FIXED_UNIT     = 0.0001 # mm or degrees
+
+# Raster powers per command, at most RASTER_MAX_PIXELS in AVR config.h
+RASTER_MAX = 120
+
+# Lines between absolute binary line targets
+RESYNC_INTERVAL = 64
+
 
 def encode_float(x):
     import struct
@@ -103,7 +122,8 @@ def modbus_write(addr, value): return MODBUS_WRITE + '%d=%d' % (addr, value)
 def set_axis(axis, position): return SET_AXIS + axis + encode_float(position)
 
 
-def line(target, exitVel, maxAccel, maxJerk, times, speeds):
+def line(target, exitVel, maxAccel, maxJerk, times, speeds, outputs = [],
+         raster = None):
     cmd = LINE
 
     cmd += encode_float(exitVel)
@@ -116,13 +136,105 @@ def line(target, exitVel, maxAccel, maxJerk, times, speeds):
         if times[i]:
             cmd += str(i) + encode_float(times[i] / 60000) # to mins
 
-    # Speeds
-    for dist, speed in speeds:
-        cmd += '\n' + sync_speed(dist, speed)
+    # Speeds and outputs, changed at a distance along the line.  The AVR
+    # loads them in order so they must be sorted by distance.
+    sync = [(dist, sync_speed(dist, speed)) for dist, speed in speeds]
+    sync += [(dist, sync_output(dist, port, value))
+             for dist, port, value in outputs]
+
+    for dist, c in sorted(sync, key = lambda x: x[0]):
+        cmd += '\n' + c
+
+    # Laser powers, (offset, pitch, powers) along the line
+    if raster is not None:
+        cmd += '\n' + raster_powers(*raster)
 
     return cmd
 
 
+def crc8(data):
+    crc = 0
+
+    for b in data:
+        crc ^= b
+        for i in range(8):
+            crc = ((crc << 1) ^ 0x07 if crc & 0x80 else crc << 1) & 0xff
+
+    return crc
+
+
+def frame(payload, seq):
+    data = bytes([len(payload) + 1, seq]) + payload
+    return bytes([FRAME_START]) + data + bytes([crc8(data)])
+
+
+def encode_varint(x):
+    u = x << 1 if 0 <= x else (-x << 1) - 1 # Zigzag
+    data = b''
+
+    while 0x7f < u:
+        data += bytes([u & 0x7f | 0x80])
+        u >>= 7
+
+    return data + bytes([u])
+
+
+def binary_targets(target, times, fixed = False, delta = False):
+    '''Returns binary line flags and encoded axes and times.  If fixed, target
+    axes are integers in FIXED_UNIT, relative to the last target if delta.'''
+    import struct
+
+    flags = 0
+    data = b''
+
+    if fixed: flags |= LINE_FIXED_BM
+    if delta: flags |= LINE_DELTA_BM
+
+    for i, axis in enumerate('xyzabc'):
+        if axis in target:
+            flags |= 1 << i
+            if fixed: data += encode_varint(target[axis])
+            else: data += struct.pack('<f', target[axis])
+
+    # S-Curve times in minutes
+    for i in range(7):
+        if times[i]:
+            flags |= 1 << (LINE_TIMES_BP + i)
+            data += struct.pack('<f', times[i])
+
+    return flags, data
+
+
+def binary_line(id, exitVel, limits, flags, targets):
+    import struct
+
+    values = [exitVel]
+
+    if limits is not None:
+        flags |= LINE_LIMITS_BM
+        values += limits
+
+    payload = struct.pack('<cHH%df' % len(values), BINARY_LINE.encode(),
+                          id & 0xffff, flags, *values)
+
+    return payload + targets
+
+
+def line_batch(id, limits, segments):
+    '''Segments are (id, exitVel, flags, targets), see binary_targets()'''
+    import struct
+
+    payload = struct.pack('<cHB2f', LINE_BATCH.encode(), id & 0xffff,
+                          len(segments), *limits)
+
+    for segId, exitVel, flags, targets in segments:
+        payload += struct.pack('<BHf', (segId - id) & 0xffff, flags, exitVel)
+        payload += targets
+        id = segId
+
+    return payload
+
+
 def speed(value): return SPEED + encode_float(value)
 
 
@@ -130,6 +242,26 @@ def sync_speed(dist, speed):
     return SYNC_SPEED + encode_float(dist) + encode_float(speed)
 
 
+def sync_output(dist, port, value):
+    return SYNC_OUTPUT + encode_float(dist) + _get_output_id(port) + \
+        ('1' if value else '0')
+
+
+def raster_powers(offset, pitch, powers):
+    import base64
+
+    cmds = []
+
+    for i in range(0, len(powers), RASTER_MAX):
+        chunk = powers[i:i + RASTER_MAX]
+        data = bytes(min(255, max(0, int(round(p * 255)))) for p in chunk)
+        cmds.append(RASTER + encode_float(offset + i * pitch) +
+                    encode_float(pitch) +
+                    base64.b64encode(data).decode('utf-8').rstrip('='))
+
+    return '\n'.join(cmds)
+
+
 def _get_input_type_index(port):
     if port == 'digital-in-0': return 'd', 0
     if port == 'digital-in-1': return 'd', 1
@@ -263,6 +395,22 @@ def decode_command(cmd):
         data['offset'] = decode_float(cmd[1:7])
         data['speed']  = decode_float(cmd[7:13])
 
+    elif cmd[0] == RASTER:
+        import base64
+
+        data['type'] = 'raster'
+        data['offset'] = decode_float(cmd[1:7])
+        data['pitch']  = decode_float(cmd[7:13])
+        powers = cmd[13:]
+        powers = base64.b64decode(powers + '=' * (-len(powers) % 4))
+        data['powers'] = [p / 255 for p in powers]
+
+    elif cmd[0] == SYNC_OUTPUT:
+        data['type'] = 'output'
+        data['offset'] = decode_float(cmd[1:7])
+        data['output'] = cmd[7]
+        data['value']  = cmd[8] == '1'
+
     elif cmd[0] == REPORT:   data['type'] = 'report'
     elif cmd[0] == PAUSE:    data['type'] = 'pause'
     elif cmd[0] == UNPAUSE:  data['type'] = 'unpause'
@@ -275,6 +423,140 @@ def decode_command(cmd):
     return data
 
 
+class Encoder(object):
+    '''Converts ASCII commands to binary frames where the AVR supports it'''
+
+    def __init__(self):
+        self.seq = 0
+        self.frames = [] # (seq, lines, bytes) of frames not yet taken
+        self.reset()
+
+
+    def reset(self):
+        # The AVR forgets these on flush, must resend after resume
+        self.limits = None
+        self.reset_position()
+
+
+    def reset_position(self):
+        # The AVR resets its position after jogs, stops and flushes.  The next
+        # line must then be sent absolute.
+        self.position = {} # Last fixed target
+        self.resync = 0    # Lines until next absolute target
+
+
+    def _parse(self, cmds):
+        id_prefix = SET_SYNC + 'id='
+
+        for cmd in cmds:
+            lines = [line.strip() for line in cmd.strip().split('\n')]
+            i = 0
+
+            while i < len(lines):
+                line = lines[i]
+                i += 1
+
+                # Merge command id into following line
+                if (line.startswith(id_prefix) and i < len(lines) and
+                    lines[i].startswith(LINE)):
+                    yield int(line[len(id_prefix):]), decode_command(lines[i])
+                    i += 1
+
+                else: yield line
+
+
+    def _segment(self, id, line):
+        fixed = {axis: int(round(value / FIXED_UNIT))
+                 for axis, value in line['target'].items()}
+
+        # Send deltas between periodic absolute targets
+        delta = 0 < self.resync and all(a in self.position for a in fixed)
+
+        if delta:
+            self.resync -= 1
+            target = {axis: value - self.position[axis]
+                      for axis, value in fixed.items()
+                      if value != self.position[axis]}
+
+        else:
+            self.resync = RESYNC_INTERVAL
+            target = fixed
+
+        self.position.update(fixed)
+        flags, targets = binary_targets(target, line['times'], True, delta)
+
+        return id, line['exit-vel'], flags, targets
+
+
+    def _frame(self, payload, lines):
+        data = frame(payload, self.seq)
+        self.frames.append((self.seq, lines, len(data)))
+        self.seq = (self.seq + 1) & 0xff
+        return data
+
+
+    def _encode_batch(self, batch, limits):
+        if not batch: return b''
+
+        if len(batch) == 1:
+            if limits == self.limits: limits = None
+            else: self.limits = limits
+
+            id, exitVel, flags, targets = batch[0]
+            payload = binary_line(id, exitVel, limits, flags, targets)
+
+        else:
+            self.limits = limits
+            payload = line_batch(batch[0][0], limits, batch)
+
+        return self._frame(payload, len(batch))
+
+
+    def take_frames(self):
+        frames, self.frames = self.frames, []
+        return frames
+
+
+    def encode(self, cmds):
+        data = b''
+        batch = []
+        limits = None
+        size = 0
+
+        for item in self._parse(cmds):
+            if isinstance(item, str):
+                data += self._encode_batch(batch, limits)
+                batch = []
+
+                # Track AVR position resets
+                if item == RESUME: self.reset()
+                elif item[:1] in (LINE, JOG): self.reset_position()
+                elif item.startswith(SET_AXIS): self.position.pop(item[1], None)
+
+                data += bytes(item + '\n', 'utf-8')
+                continue
+
+            id, line = item
+            lineLimits = [line['max-accel'], line['max-jerk']]
+            seg = self._segment(id, line)
+            segSize = 7 + len(seg[3])
+
+            # Start a new batch if this line does not fit
+            if batch and (FRAME_MAX < size + segSize or lineLimits != limits or
+                          255 < ((id - batch[-1][0]) & 0xffff)):
+                data += self._encode_batch(batch, limits)
+                batch = []
+
+            if not batch:
+                limits = lineLimits
+                size = 12 # Batch header
+
+            batch.append(seg)
+            size += segSize
+
+        return data + self._encode_batch(batch, limits)
+
+
 def decode(cmd):
     for line in cmd.split('\n'):
         yield decode_command(line.strip())
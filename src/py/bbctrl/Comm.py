@@ -51,6 +51,12 @@ DRV8711_COMM_ERROR_bm    = 1 << 8
 # Ignoring stall and stall latch flags for now
 DRV8711_MASK = ~(DRV8711_STATUS_STD_bm | DRV8711_STATUS_STDLAT_bm)
 
+# Max planner commands to send at once when using binary frames
+BATCH_COMMANDS = 16
+
+# Max unacknowledged binary frame bytes, must fit in the AVR's Rx buffer
+RX_WINDOW = 768
+
 
 def _driver_flags_to_string(flags):
     if DRV8711_STATUS_OTS_bm    & flags: yield 'over temp'
@@ -76,6 +82,10 @@ class Comm(ABC):
         self.queue = deque()
         self.in_buf = ''
         self.command = None
+        self.encoder = Cmd.Encoder()
+        self.binary = False
+        self.inflight = deque() # (seq, lines, bytes) of unacknowledged frames
+        self.credit = None      # Last AVR credit report
         self.last_motor_flags = [0] * 4
         self.estopped = False
 
@@ -98,6 +108,11 @@ class Comm(ABC):
 
     def i2c_command(self, cmd, byte = None, word = None, block = None):
         self.log.info('I2C: %s b=%s w=%s d=%s' % (cmd, byte, word, block))
+
+        # The AVR resets its position once these stop motion
+        if cmd in (Cmd.PAUSE, Cmd.STOP, Cmd.ESTOP, Cmd.FLUSH):
+            self.encoder.reset_position()
+
         self.avr.i2c_command(cmd, byte, word, block)
 
 
@@ -115,9 +130,40 @@ class Comm(ABC):
     def flush(self): self.avr.enable_write(True)
 
 
-    def _prep_command(self, cmd):
-        self.log.info('< ' + json.dumps(cmd).strip('"'))
-        return bytes(cmd.strip() + '\n', 'utf-8')
+    def _prep_command(self, *cmds):
+        for cmd in cmds: self.log.info('< ' + json.dumps(cmd).strip('"'))
+
+        if self.binary:
+            data = self.encoder.encode(cmds)
+            self.inflight.extend(self.encoder.take_frames())
+            return data
+
+        return b''.join(bytes(cmd.strip() + '\n', 'utf-8') for cmd in cmds)
+
+
+    def _window(self):
+        '''Returns the number of planner commands that may be sent now'''
+        if not self.binary: return 1
+        if self.credit is None: return BATCH_COMMANDS
+
+        # Limit data in flight to what the AVR can buffer
+        if RX_WINDOW < sum(frame[2] for frame in self.inflight): return 0
+
+        # Keep the AVR's command queue full but do not overfill it
+        lines = self.credit['space'] // self.credit['line']
+        lines -= sum(frame[1] for frame in self.inflight)
+
+        return max(0, min(BATCH_COMMANDS, lines))
+
+
+    def _update_credit(self, credit):
+        # Release frames the AVR has consumed
+        while len(self.inflight) and \
+              ((credit['seq'] - self.inflight[0][0]) & 0xff) < 128:
+            self.inflight.popleft()
+
+        self.credit = credit
+        self.flush() # May be able to send more now
 
 
     def resume(self): self.queue_command(Cmd.RESUME)
@@ -152,17 +198,27 @@ class Comm(ABC):
         if len(self.queue):
             self.command = self._prep_command(self.queue.popleft())
 
-        # Load next command from callback
+        # Load next commands from callback, batched if binary
         else:
-            cmd = self.comm_next() # pylint: disable=assignment-from-no-return
+            cmds = []
+            window = self._window()
+
+            while len(cmds) < window:
+                # pylint: disable=assignment-from-no-return
+                cmd = self.comm_next()
+                if cmd is None: break
+                cmds.append(cmd)
 
-            if cmd is None: self.avr.enable_write(False) # Stop writing
-            else: self.command = self._prep_command(cmd)
+            if not cmds: self.avr.enable_write(False) # Stop writing
+            else: self.command = self._prep_command(*cmds)
 
 
     def _update_vars(self, msg):
         try:
             self.ctrl.state.set_machine_vars(msg['variables'])
+
+            # Use binary frames if the AVR supports them
+            self.binary = Cmd.BINARY_LINE in msg.get('commands', {})
             self.ctrl.configure()
             self.queue_command(Cmd.DUMP) # Refresh all vars
 
@@ -239,6 +295,11 @@ class Comm(ABC):
                     if not 'firmware' in msg: continue
                     self.estopped = False
 
+                # Frequent flow control reports are not logged
+                if 'credit' in msg:
+                    self._update_credit(msg['credit'])
+                    continue
+
                 self.log.info('> ' + line)
 
                 if 'variables' in msg: self._update_vars(msg)
@@ -278,6 +339,12 @@ class Comm(ABC):
 
     def connect(self):
         try:
+            # Send ASCII until the AVR's commands are known
+            self.binary = False
+            self.encoder.reset()
+            self.inflight.clear()
+            self.credit = None
+
             # Resume once current queue of GCode commands has flushed
             self.queue_command(Cmd.RESUME)
             self.queue_command(Cmd.HELP) # Load AVR commands and variables
@@ -142,8 +142,12 @@ class Config(object):
             if template['type'] == 'list':
                 if 'index' in template:
                     config = config[name]
+                    defaults = template['default']
                     for i in range(len(template['index'])):
-                        if len(config) <= i: config.append({})
+                        if len(config) <= i:
+                            if i < len(defaults):
+                                config.append(copy.deepcopy(defaults[i]))
+                            else: config.append({})
 
                         for name, tmpl in template['template'].items():
                             self.__defaults(config[i], name, tmpl)
@@ -143,7 +143,7 @@ class Mach(Comm):
             self.planner.stop()
             self.ctrl.state.set('line', 0)
 
-        else: self.planner.restart()
+        else: self.planner.restart(pause_reason == 'Switch found')
 
         super().i2c_command(Cmd.UNPAUSE)
         self.unpausing = True
@@ -42,6 +42,9 @@ except:
 __all__ = ['Planner']
 
 
+RASTER_MIN = 8 # Evenly spaced speeds in a line sent as a laser raster
+
+
 reLogLine = re.compile(
     r'^(?P<level>[A-Z])[0-9 ]:'
     r'((?P<file>[^:]+):)?'
@@ -68,6 +71,7 @@ class Planner():
         self.end_callbacks = deque()
         self.planner       = None
         self.where         = ''
+        self.outputs       = [] # Output changes waiting for the next line
 
         ctrl.state.add_listener(self._update)
 
@@ -240,6 +244,37 @@ class Planner():
         self.plan_time += block['seconds']
 
 
+    def _flush_outputs(self):
+        cmds = [Cmd.output(port, value) for dist, port, value in self.outputs]
+        self.outputs = []
+        return '\n'.join(cmds)
+
+
+    def _raster(self, speeds):
+        '''Returns speeds and a laser raster.  Evenly spaced speeds along a
+        line are sent as a raster of powers, which the AVR applies at 4 kHz.
+        The last speed stays a sync speed so it holds after the line.'''
+        config = self.ctrl.config
+        maxSpin = config.get('max-spin', 0)
+        minSpin = config.get('min-spin', 0)
+
+        if (len(speeds) < RASTER_MIN or maxSpin <= 0 or
+            config.get('tool-type') != 'PWM Spindle'): return speeds, None
+
+        start = speeds[0][0]
+        pitch = (speeds[-1][0] - start) / (len(speeds) - 1)
+        if pitch <= 0: return speeds, None
+
+        for i, (dist, speed) in enumerate(speeds):
+            if speed < 0 or pitch * 0.01 < abs(dist - start - i * pitch):
+                return speeds, None
+
+        powers = [0 if speed < minSpin else min(1, speed / maxSpin)
+                  for dist, speed in speeds[:-1]]
+
+        return speeds[-1:], (start, pitch, powers)
+
+
     def __encode(self, block):
         type, id = block['type'], block['id']
 
@@ -249,9 +284,12 @@ class Planner():
 
         if type == 'line':
             self._enqueue_line_time(block)
+            speeds, raster = self._raster(block.get('speeds', []))
+            outputs, self.outputs = self.outputs, []
+
             return Cmd.line(block['target'], block['exit-vel'],
                             block['max-accel'], block['max-jerk'],
-                            block['times'], block.get('speeds', []))
+                            block['times'], speeds, outputs, raster)
 
         if type == 'set':
             name, value = block['name'], block['value']
@@ -273,6 +311,9 @@ class Planner():
             if name == '_feed': # Must come after _enqueue_set_cmd() above
                 return Cmd.set_sync('if', 1 / value if value else 0)
 
+            if name == '_spindle_sync':
+                return Cmd.set_sync('sy', 1 if value else 0)
+
             if name[0:1] == '_' and name[1:2] in 'xyzabc':
                 if name[2:] == '_home': return Cmd.set_axis(name[1], value)
 
@@ -287,7 +328,10 @@ class Planner():
             return Cmd.input(block['port'], block['mode'], block['timeout'])
 
         if type == 'output':
-            return Cmd.output(block['port'], int(float(block['value'])))
+            # Sent with the next line, so the step interrupt changes it where
+            # that line starts rather than when exec reaches it
+            self.outputs.append((0, block['port'], int(float(block['value']))))
+            return
 
         if type == 'dwell':
             self._enqueue_dwell_time(block)
@@ -309,6 +353,10 @@ class Planner():
     def _encode(self, block):
         cmd = self.__encode(block)
 
+        # Commands other than lines must not pass held output changes
+        if cmd is not None and block['type'] != 'line' and self.outputs:
+            cmd = self._flush_outputs() + '\n' + cmd
+
         if cmd is not None:
             # Enqueue id with no callback to track command activity
             self.cmdq.enqueue(block['id'], None)
@@ -337,6 +385,7 @@ class Planner():
         # TODO logger is global and will not work correctly in demo mode
         camotics.set_logger(self._log_cb, 1, 'LinePlanner:3')
         self.cmdq.clear()
+        self.outputs = []
         self.reset_times()
         self.ctrl.state.reset()
 
@@ -375,6 +424,7 @@ class Planner():
         try:
             self.planner.stop()
             self.cmdq.clear()
+            self.outputs = []
             self._end_program('Program stop', True)
 
         except:
@@ -382,15 +432,28 @@ class Planner():
             self.reset()
 
 
-    def restart(self):
+    def restart(self, seek = False):
         try:
-            id = self.ctrl.state.get('id')
-            position = self.ctrl.state.get_position()
+            state = self.ctrl.state
+            id = state.get('id')
+            position = state.get_position()
+
+            # The motors overrun a seek switch while stopping, so planning
+            # continues from where they stopped.  The position latched when
+            # the switch tripped is the probe result, e.g. #<_probe_x>.
+            if seek:
+                latched = state.get('la', False)
+
+                for axis, value in position.items():
+                    if latched and state.has(axis + 'lp'):
+                        value = state.get(axis + 'lp')
+                    state.set('probe_' + axis, value)
 
             self.log.info('Planner restart: %d %s' % (id, log_json(position)))
 
             self.cmdq.clear()
             self.cmdq.release(id)
+            self.outputs = []
             self._plan_time_restart()
             self.planner.restart(id, position)
 
@@ -405,6 +468,9 @@ class Planner():
                 cmd = self._encode(self.planner.next())
                 if cmd is not None: return cmd
 
+            # Do not hold output changes for a line that may not come
+            if self.outputs: return self._flush_outputs()
+
         except RuntimeError as e:
             # Pass on the planner message
             self.log.error(str(e))
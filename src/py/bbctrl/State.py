@@ -64,7 +64,7 @@ class State(object):
         #
         # NOTE, variable callbacks must return metric values only because
         # the planner will scale returned values when in imperial mode.
-        for i in range(4):
+        for i in range(5):
             self.set_callback(str(i) + 'home_position',
                               lambda name, i = i: self.motor_home_position(i))
             self.set_callback(str(i) + 'home_travel',
@@ -95,7 +95,7 @@ class State(object):
         self.set('active_program', '')
 
         # Unhome all motors
-        for i in range(4): self.set('%dhomed' % i, 0)
+        for i in range(5): self.set('%dhomed' % i, 0)
 
         # Zero offsets and positions
         for axis in 'xyzabc':
@@ -188,7 +188,7 @@ class State(object):
         axis_vars = {}
 
         for name, value in vars.items():
-            if name[0] in '0123':
+            if name[0] in '01234':
                 motor = int(name[0])
 
                 for axis in 'xyzabc':
@@ -258,7 +258,7 @@ class State(object):
 
 
     def find_motor(self, axis):
-        for motor in range(4):
+        for motor in range(5):
             if not ('%dan' % motor) in self.vars: continue
             motor_axis = 'xyzabc'[self.vars['%dan' % motor]]
             if motor_axis == axis.lower() and self.vars.get('%dme' % motor, 0):
@@ -0,0 +1,63 @@
+import os
+import struct
+import sys
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', 'src', 'py'))
+
+from bbctrl import Cmd
+
+
+def line(id, x):
+    return Cmd.set_sync('id', id) + '\n' + \
+        Cmd.line({'x': x}, 0, 1000, 50000, [0.01, 0, 0, 0, 0, 0, 0], [])
+
+
+def frame_flags(data):
+    '''Returns the flags of each binary line frame in data'''
+    flags = []
+
+    while data:
+        if data[0] != Cmd.FRAME_START:
+            data = data[data.index(b'\n') + 1:] # Skip ASCII command
+            continue
+
+        length = data[1]
+        payload = data[3:2 + length]
+        if payload[:1] == Cmd.BINARY_LINE.encode():
+            flags.append(struct.unpack('<H', payload[3:5])[0])
+
+        data = data[3 + length:]
+
+    return flags
+
+
+class EncoderTest(unittest.TestCase):
+    def encode(self, *cmds): return frame_flags(self.encoder.encode(cmds))
+
+
+    def setUp(self): self.encoder = Cmd.Encoder()
+
+
+    def test_delta(self):
+        self.assertFalse(self.encode(line(1, 1))[0] & Cmd.LINE_DELTA_BM)
+        self.assertTrue(self.encode(line(2, 2))[0] & Cmd.LINE_DELTA_BM)
+
+
+    def test_jog_then_line(self):
+        self.encode(line(1, 1))
+        self.encode(Cmd.jog(1, {'x': 0.5}))
+
+        # The AVR reset its position after the jog
+        flags = self.encode(line(2, 2))[0]
+        self.assertTrue(flags & Cmd.LINE_FIXED_BM)
+        self.assertFalse(flags & Cmd.LINE_DELTA_BM)
+
+
+    def test_reset_position(self):
+        self.encode(line(1, 1))
+        self.encoder.reset_position()
+        self.assertFalse(self.encode(line(2, 2))[0] & Cmd.LINE_DELTA_BM)
+
+
+if __name__ == '__main__': unittest.main()
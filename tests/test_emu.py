@@ -0,0 +1,93 @@
+import json
+import os
+import subprocess
+import sys
+import time
+import unittest
+
+root = os.path.join(os.path.dirname(__file__), '..')
+sys.path.insert(0, os.path.join(root, 'src', 'py'))
+
+from bbctrl import Cmd
+
+EMU = os.path.join(root, 'src', 'avr', 'emu', 'bbemu')
+
+
+@unittest.skipUnless(os.path.exists(EMU), 'AVR emulator not built')
+class EmuTest(unittest.TestCase):
+    def setUp(self):
+        self.emu = subprocess.Popen([EMU], stdin = subprocess.PIPE,
+                                    stdout = subprocess.PIPE,
+                                    stderr = subprocess.DEVNULL)
+        self.vars = {}
+        self.wait(lambda: 'firmware' in self.vars)
+        self.send(Cmd.RESUME)
+
+
+    def tearDown(self):
+        self.emu.kill()
+        self.emu.wait()
+
+
+    def send(self, *cmds):
+        for cmd in cmds: self.emu.stdin.write((cmd + '\n').encode())
+        self.emu.stdin.flush()
+
+
+    def wait(self, done, timeout = 20):
+        end = time.time() + timeout
+
+        while not done():
+            self.assertLess(time.time(), end, 'Timed out')
+            line = self.emu.stdout.readline()
+            self.assertTrue(line, 'Emulator exited')
+
+            try: msg = json.loads(line)
+            except ValueError: continue
+            if isinstance(msg, dict): self.vars.update(msg)
+
+
+    def test_set_axis_between_lines(self):
+        self.send(Cmd.set_sync('id', 1))
+
+        # Exits moving, so a partial segment carries over the set axis
+        self.send(Cmd.line({'x': 1, 'y': 0}, 1000, 1e6, 5e7,
+                           [101, 0, 0, 0, 0, 0, 0], []),
+                  Cmd.set_axis('x', 5),
+                  Cmd.set_sync('id', 2),
+                  Cmd.line({'x': 5, 'y': 1}, 0, 1e6, 5e7,
+                           [0, 0, 0, 0, 101, 0, 0], []))
+
+        self.wait(lambda: self.vars.get('xx') == 'READY' and
+                  self.vars.get('id') == 2)
+
+        # X is not in the second line and must stay at the set position
+        self.assertAlmostEqual(self.vars['xp'], 5, 3)
+        self.assertAlmostEqual(self.vars['yp'], 1, 3)
+
+
+    def send_raw(self, data):
+        self.emu.stdin.write(data)
+        self.emu.stdin.flush()
+
+
+    def test_bad_frame_resync(self):
+        # Bad CRC, the rest of the line must not run as a command
+        bad = bytes([Cmd.FRAME_START, 2, 1, 0, 0])
+        self.send_raw(bad + Cmd.set_sync('id', 9).encode() + b'\n')
+        time.sleep(0.5)
+        self.send_raw(Cmd.frame(Cmd.set_sync('id', 3).encode(), 2))
+
+        seen = []
+        self.wait(lambda: seen.append(self.vars.get('id')) or
+                  self.vars.get('id') == 3)
+        self.assertNotIn(9, seen)
+
+
+    def test_stalled_frame_dropped(self):
+        frame = Cmd.frame(Cmd.set_sync('id', 4).encode(), 1)
+        self.send_raw(frame[:4])
+        time.sleep(0.5)
+        self.send_raw(Cmd.frame(Cmd.set_sync('id', 5).encode(), 2))
+
+        self.wait(lambda: self.vars.get('id') == 5)
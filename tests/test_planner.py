@@ -0,0 +1,86 @@
+import os
+import sys
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', 'src', 'py'))
+
+from bbctrl import Cmd
+from bbctrl.Planner import Planner
+
+
+class Config(dict):
+    def get(self, name, default = None): return dict.get(self, name, default)
+
+
+class Ctrl(object):
+    def __init__(self, **config): self.config = Config(config)
+
+
+class Log(object):
+    def info(self, *args, **kwargs): pass
+
+
+class CommandQueue(object):
+    def enqueue(self, *args): pass
+
+
+def planner(**config):
+    p = Planner.__new__(Planner)
+    p.ctrl = Ctrl(**config)
+    p.log = Log()
+    p.cmdq = CommandQueue()
+    p.outputs = []
+    p.plan_time = 0
+    return p
+
+
+def line(id, x, speeds = []):
+    return {'type': 'line', 'id': id, 'target': {'x': x}, 'exit-vel': 0,
+            'max-accel': 1000, 'max-jerk': 50000,
+            'times': [1, 0, 0, 0, 0, 0, 0], 'speeds': speeds, 'first': True}
+
+
+class PlannerTest(unittest.TestCase):
+    def test_raster(self):
+        p = planner(**{'tool-type': 'PWM Spindle', 'max-spin': 1000})
+        speeds = [(i * 0.1, i * 100) for i in range(11)]
+
+        speeds, raster = p._raster(speeds)
+        self.assertEqual(speeds, [(1.0, 1000)])
+        self.assertEqual(raster[0], 0)
+        self.assertAlmostEqual(raster[1], 0.1)
+        self.assertEqual(len(raster[2]), 10)
+        self.assertAlmostEqual(raster[2][5], 0.5)
+
+
+    def test_no_raster(self):
+        p = planner(**{'tool-type': 'PWM Spindle', 'max-spin': 1000})
+
+        # Too few, uneven or not a laser
+        speeds = [(0, 100), (1, 200)]
+        self.assertEqual(p._raster(speeds), (speeds, None))
+        speeds = [(i * i, 100) for i in range(10)]
+        self.assertEqual(p._raster(speeds), (speeds, None))
+        p.ctrl.config['tool-type'] = 'Huanyang VFD'
+        speeds = [(i, 100) for i in range(10)]
+        self.assertEqual(p._raster(speeds), (speeds, None))
+
+
+    def test_output_with_next_line(self):
+        p = planner()
+        block = {'type': 'output', 'id': 1, 'port': 'mist', 'value': 1}
+
+        self.assertIsNone(p._encode(block))
+        cmd = p._encode(line(2, 5))
+        self.assertIn(Cmd.sync_output(0, 'mist', 1), cmd.split('\n'))
+        self.assertNotIn('#Moa=1', cmd)
+
+
+    def test_output_before_other_command(self):
+        p = planner()
+        p._encode({'type': 'output', 'id': 1, 'port': 'flood', 'value': 1})
+        cmd = p._encode({'type': 'dwell', 'id': 2, 'seconds': 1})
+        self.assertIn(Cmd.output('flood', 1), cmd.split('\n'))
+
+
+if __name__ == '__main__': unittest.main()